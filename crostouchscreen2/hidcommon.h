@@ -16,6 +16,7 @@
 
 #define REPORTID_MTOUCH         0x01
 #define REPORTID_FEATURE        0x02
+#define REPORTID_LATENCY        0x03
 
 //
 // Multitouch specific report information
@@ -55,6 +56,8 @@ typedef struct _RAYD_MULTITOUCH_REPORT
 
 	TOUCH     Touch[10];
 
+	USHORT    ScanTime;
+
 	BYTE      ActualCount;
 
 } RaydMultiTouchReport;
@@ -88,6 +91,22 @@ typedef struct _RAYD_MAXCOUNT_REPORT
 	BYTE         MaximumCount;
 
 } RaydMaxCountReport;
+
+//
+// Vendor latency report, per stage histograms of touch pipeline latency
+//
+
+#define RAYD_LATENCY_STAGES      5
+#define RAYD_LATENCY_BUCKETS     16
+
+typedef struct _RAYD_LATENCY_REPORT
+{
+
+	BYTE         ReportID;
+
+	ULONG        Histogram[RAYD_LATENCY_STAGES][RAYD_LATENCY_BUCKETS];
+
+} RaydLatencyReport;
 #pragma pack()
 
 #endif
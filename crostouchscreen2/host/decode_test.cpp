@@ -0,0 +1,243 @@
+/*++
+
+Module Name:
+
+decode_test.cpp
+
+Abstract:
+
+Tests for the per frame kernels of the interrupt path: the packet
+checksum and the contact decoders, checked against plain reference
+loops and timed against them on realistic packet layouts.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <chrono>
+#include <memory>
+#include <random>
+
+#include "host_test.h"
+#include "rayd_harness.h"
+
+//
+// Packets of 5 and 10 slots of 8 byte contacts, 10 slots of 10 bytes and
+// 20 slots of 8 or 10 slots of 16 bytes
+//
+static const UINT16 DecodeTestPackageSizes[] = { 42, 82, 102, 162 };
+
+#define DECODE_TEST_ITERATIONS	100000
+
+static UINT16 DecodeTestByteSum(const UINT8* Buffer, UINT16 Length)
+{
+	UINT16 sum = 0;
+
+	for (UINT16 i = 0; i < Length; i++)
+		sum += Buffer[i];
+
+	return sum;
+}
+
+static double DecodeTestNanoseconds(std::chrono::steady_clock::time_point Start, ULONG Iterations)
+{
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - Start;
+
+	return elapsed.count() / Iterations;
+}
+
+//
+// A context holding only what the decoders use
+//
+static std::unique_ptr<RAYD_CONTEXT> DecodeTestContext(UINT8 ContactSize, UINT8 Slots)
+{
+	std::unique_ptr<RAYD_CONTEXT> context(new RAYD_CONTEXT());
+
+	context->contactSize = ContactSize;
+	context->packageSize = (UINT8)(ContactSize * Slots + RM_PACKET_CRC_SIZE);
+	context->reportSize = context->packageSize - RM_PACKET_CRC_SIZE;
+	return context;
+}
+
+//
+// A packet where each slot is down with the given odds, at a position
+// that moves a little from frame to frame
+//
+static void DecodeTestFrame(std::mt19937& Random, UINT8* Packet, UINT8 ContactSize, UINT8 Slots, int DownPercent)
+{
+	memset(Packet, 0, ContactSize * Slots);
+
+	for (int i = 0; i < Slots; i++) {
+		struct raydium_contact* contact = (struct raydium_contact*)&Packet[ContactSize * i];
+		USHORT x = (USHORT)(Random() % 1366);
+		USHORT y = (USHORT)(Random() % 768);
+
+		if ((int)(Random() % 100) >= DownPercent)
+			continue;
+
+		contact->state = 1;
+		contact->x[0] = x & 0xFF;
+		contact->x[1] = x >> 8;
+		contact->y[0] = y & 0xFF;
+		contact->y[1] = y >> 8;
+		contact->width_x = (UINT8)(Random() % 4 ? 8 : Random());
+		contact->width_y = (UINT8)(Random() % 4 ? 6 : Random());
+	}
+}
+
+TEST(ChecksumMatchesTheByteSum)
+{
+	std::mt19937 random(11);
+	UINT8 buffer[512 + 16];
+
+	for (UINT8& byte : buffer)
+		byte = (UINT8)random();
+
+	//
+	// Every length around the 16 byte blocks, from every alignment
+	//
+	for (UINT16 offset = 0; offset < 16; offset++) {
+		for (UINT16 length = 0; length <= 512; length++)
+			EXPECT_EQ(raydium_calc_chksum(&buffer[offset], length), DecodeTestByteSum(&buffer[offset], length));
+	}
+
+	//
+	// The sum wraps at 16 bits
+	//
+	memset(buffer, 0xFF, sizeof(buffer));
+	EXPECT_EQ(raydium_calc_chksum(buffer, 512), (UINT16)(512 * 0xFF));
+}
+
+TEST(ChecksumBenchmark)
+{
+	std::mt19937 random(12);
+	UINT8 packet[512];
+	volatile UINT16 sink = 0;
+
+	for (UINT8& byte : packet)
+		byte = (UINT8)random();
+
+	for (UINT16 size : DecodeTestPackageSizes) {
+		std::chrono::steady_clock::time_point start;
+		double kernel, reference;
+
+		start = std::chrono::steady_clock::now();
+		for (ULONG i = 0; i < DECODE_TEST_ITERATIONS; i++) {
+			packet[i % size] ^= 1;
+			sink = sink + raydium_calc_chksum(packet, size - RM_PACKET_CRC_SIZE);
+		}
+		kernel = DecodeTestNanoseconds(start, DECODE_TEST_ITERATIONS);
+
+		start = std::chrono::steady_clock::now();
+		for (ULONG i = 0; i < DECODE_TEST_ITERATIONS; i++) {
+			packet[i % size] ^= 1;
+			sink = sink + DecodeTestByteSum(packet, size - RM_PACKET_CRC_SIZE);
+		}
+		reference = DecodeTestNanoseconds(start, DECODE_TEST_ITERATIONS);
+
+		REPORT("%3u byte packet: checksum %.1f ns, byte loop %.1f ns", size, kernel, reference);
+	}
+}
+
+TEST(SpecializedDecodersMatchTheGenericLoop)
+{
+	std::mt19937 random(13);
+	UINT8 packet[RAYD_MAX_CONTACT_SLOTS * 16];
+
+	for (const auto& decoder : raydium_decoders) {
+		std::unique_ptr<RAYD_CONTEXT> fixed = DecodeTestContext(decoder.ContactSize, decoder.Slots);
+		std::unique_ptr<RAYD_CONTEXT> generic = DecodeTestContext(decoder.ContactSize, decoder.Slots);
+
+		EXPECT_EQ(raydium_select_decoder(fixed.get()), STATUS_SUCCESS);
+		EXPECT(fixed->DecodeFrame == decoder.Decode);
+		EXPECT_EQ(fixed->contactSlots, decoder.Slots);
+
+		EXPECT_EQ(raydium_select_decoder(generic.get()), STATUS_SUCCESS);
+		generic->DecodeFrame = raydium_decode_generic;
+
+		for (int frame = 0; frame < 1000; frame++) {
+			//
+			// Runs of lifts and of steady contacts as well as random frames
+			//
+			DecodeTestFrame(random, packet, decoder.ContactSize, decoder.Slots, frame % 50 < 10 ? 0 : 60);
+
+			fixed->FrameChanged = generic->FrameChanged = false;
+			fixed->DecodeFrame(fixed.get(), packet);
+			generic->DecodeFrame(generic.get(), packet);
+
+			EXPECT_EQ(fixed->DownSlots, generic->DownSlots);
+			EXPECT_EQ(fixed->ReleasedSlots, generic->ReleasedSlots);
+			EXPECT_EQ(fixed->FrameChanged, generic->FrameChanged);
+			EXPECT(memcmp(fixed->XValue, generic->XValue, sizeof(fixed->XValue)) == 0);
+			EXPECT(memcmp(fixed->YValue, generic->YValue, sizeof(fixed->YValue)) == 0);
+			EXPECT(memcmp(fixed->AREA, generic->AREA, sizeof(fixed->AREA)) == 0);
+		}
+	}
+}
+
+TEST(DecoderBenchmark)
+{
+	std::mt19937 random(14);
+	UINT8 packet[RAYD_MAX_CONTACT_SLOTS * 16];
+
+	for (const auto& decoder : raydium_decoders) {
+		std::unique_ptr<RAYD_CONTEXT> context = DecodeTestContext(decoder.ContactSize, decoder.Slots);
+		std::chrono::steady_clock::time_point start;
+		double fixed, generic;
+
+		EXPECT_EQ(raydium_select_decoder(context.get()), STATUS_SUCCESS);
+
+		//
+		// Two fingers down, moving
+		//
+		start = std::chrono::steady_clock::now();
+		for (ULONG i = 0; i < DECODE_TEST_ITERATIONS; i++) {
+			packet[RM_CONTACT_STATE_POS] = packet[decoder.ContactSize + RM_CONTACT_STATE_POS] = 1;
+			packet[RM_CONTACT_X_POS] = (UINT8)i;
+			decoder.Decode(context.get(), packet);
+		}
+		fixed = DecodeTestNanoseconds(start, DECODE_TEST_ITERATIONS);
+
+		start = std::chrono::steady_clock::now();
+		for (ULONG i = 0; i < DECODE_TEST_ITERATIONS; i++) {
+			packet[RM_CONTACT_X_POS] = (UINT8)i;
+			raydium_decode_generic(context.get(), packet);
+		}
+		generic = DecodeTestNanoseconds(start, DECODE_TEST_ITERATIONS);
+
+		REPORT("%2u x %2u byte contacts: specialized %.1f ns, generic %.1f ns", decoder.Slots, decoder.ContactSize,
+			fixed, generic);
+	}
+}
+
+TEST(DecoderRejectsLayoutsWithoutContacts)
+{
+	static const struct {
+		UINT8 PackageSize;
+		UINT8 ContactSize;
+	} layouts[] = {
+		{ 82, 0 },
+		{ 82, sizeof(struct raydium_contact) - 1 },
+		{ RM_PACKET_CRC_SIZE, 8 },
+		{ 8, 8 },
+	};
+
+	for (const auto& layout : layouts) {
+		std::unique_ptr<RAYD_CONTEXT> context(new RAYD_CONTEXT());
+
+		context->packageSize = layout.PackageSize;
+		context->reportSize = layout.PackageSize - RM_PACKET_CRC_SIZE;
+		context->contactSize = layout.ContactSize;
+		EXPECT_EQ(raydium_select_decoder(context.get()), STATUS_DEVICE_PROTOCOL_ERROR);
+	}
+
+	//
+	// Layouts without a specialized decoder take the generic loop
+	//
+	std::unique_ptr<RAYD_CONTEXT> context = DecodeTestContext(12, 7);
+	EXPECT_EQ(raydium_select_decoder(context.get()), STATUS_SUCCESS);
+	EXPECT(context->DecodeFrame == raydium_decode_generic);
+	EXPECT_EQ(context->contactSlots, 7);
+}
@@ -0,0 +1,303 @@
+/*++
+
+Module Name:
+
+fake_spb.cpp
+
+Abstract:
+
+In-memory SPB I2C controller with request timing, fault injection and
+a transaction log.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <algorithm>
+
+#include "fake_spb.h"
+#include "wdf_shim.h"
+
+#include <spb.h>
+
+void FakeSpbTarget::FailNext(NTSTATUS Status, ULONG Count)
+{
+	while (Count--)
+		Faults.push_back({ Status, 0 });
+}
+
+void FakeSpbTarget::NackNext(ULONG Count)
+{
+	FailNext(FAKE_SPB_NACK_STATUS, Count);
+}
+
+void FakeSpbTarget::ShortReadNext(ULONG Bytes, ULONG Count)
+{
+	while (Count--)
+		Faults.push_back({ STATUS_SUCCESS, Bytes });
+}
+
+void FakeSpbTarget::SetRandomNacks(ULONG PerThousand, ULONG Seed)
+{
+	RandomNacks = PerThousand;
+	RandomSeed = Seed;
+}
+
+void FakeSpbTarget::ClearLog()
+{
+	Log.clear();
+	TransferIndex = 0;
+	MaxLockHold = 0;
+}
+
+ULONG FakeSpbTarget::Count(FAKE_SPB_OP Op) const
+{
+	return (ULONG)std::count_if(Log.begin(), Log.end(),
+		[Op](const FAKE_SPB_TRANSACTION& t) { return t.Op == Op; });
+}
+
+static bool FakeSpbIsData(FAKE_SPB_OP Op)
+{
+	return Op == FakeSpbWrite || Op == FakeSpbRead || Op == FakeSpbSequence;
+}
+
+ULONG FakeSpbTarget::DataTransfers() const
+{
+	return (ULONG)std::count_if(Log.begin(), Log.end(),
+		[](const FAKE_SPB_TRANSACTION& t) { return FakeSpbIsData(t.Op); });
+}
+
+ULONG FakeSpbTarget::BusBytes() const
+{
+	ULONG bytes = 0;
+
+	for (const FAKE_SPB_TRANSACTION& t : Log)
+		bytes += (ULONG)t.Written.size() + t.BytesRead;
+
+	return bytes;
+}
+
+LONGLONG FakeSpbTarget::BusTime() const
+{
+	LONGLONG time = 0;
+
+	for (const FAKE_SPB_TRANSACTION& t : Log) {
+		if (FakeSpbIsData(t.Op))
+			time += t.End - t.Start;
+	}
+
+	return time;
+}
+
+LONGLONG FakeSpbTarget::MaxControllerLockHold() const
+{
+	return MaxLockHold;
+}
+
+//
+// Picks the fault for the next data transfer. Returns the status to fail
+// it with, and the length to cut reads to in ShortRead (0 for none).
+//
+NTSTATUS FakeSpbTarget::TakeFault(ULONG* ShortRead)
+{
+	ULONG index = TransferIndex++;
+
+	*ShortRead = 0;
+
+	if (BeforeTransfer)
+		BeforeTransfer(index);
+
+	if (!Faults.empty()) {
+		Fault fault = Faults.front();
+
+		Faults.pop_front();
+		*ShortRead = fault.ShortRead;
+		return fault.Status;
+	}
+
+	if (RandomNacks && RtlRandomEx(&RandomSeed) % 1000 < RandomNacks)
+		return FAKE_SPB_NACK_STATUS;
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Spends the request's time on the virtual clock and logs it
+//
+void FakeSpbTarget::Transfer(FAKE_SPB_TRANSACTION* Transaction, ULONG WireBytes)
+{
+	Transaction->Start = ShimNow();
+	Transaction->ControllerLocked = Locked;
+
+	ShimSleep((LONGLONG)RequestLatencyUs * SHIM_TICKS_PER_US +
+		(LONGLONG)WireBytes * ByteTimeNs * SHIM_TICKS_PER_US / 1000);
+
+	Transaction->End = ShimNow();
+	Log.push_back(*Transaction);
+}
+
+NTSTATUS FakeSpbTarget::Write(const UINT8* Data, ULONG Length, ULONG_PTR* BytesWritten)
+{
+	FAKE_SPB_TRANSACTION transaction = {};
+	ULONG shortRead;
+
+	transaction.Op = FakeSpbWrite;
+	transaction.Status = TakeFault(&shortRead);
+	*BytesWritten = 0;
+
+	if (NT_SUCCESS(transaction.Status)) {
+		if (Device && Device->Write(Data, Length)) {
+			transaction.Written.assign(Data, Data + Length);
+			*BytesWritten = Length;
+		}
+		else {
+			transaction.Status = FAKE_SPB_NACK_STATUS;
+		}
+	}
+
+	Transfer(&transaction, 1 + (ULONG)transaction.Written.size());
+	return transaction.Status;
+}
+
+NTSTATUS FakeSpbTarget::Read(UINT8* Data, ULONG Length, ULONG_PTR* BytesRead)
+{
+	FAKE_SPB_TRANSACTION transaction = {};
+	ULONG shortRead;
+
+	transaction.Op = FakeSpbRead;
+	transaction.Status = TakeFault(&shortRead);
+	*BytesRead = 0;
+
+	if (NT_SUCCESS(transaction.Status)) {
+		ULONG length = Length;
+
+		if (shortRead)
+			length = min(length, shortRead);
+		if (MaxReadLength)
+			length = min(length, MaxReadLength);
+
+		if (Device && Device->Read(Data, length)) {
+			transaction.BytesRead = length;
+			*BytesRead = length;
+		}
+		else {
+			transaction.Status = FAKE_SPB_NACK_STATUS;
+		}
+	}
+
+	Transfer(&transaction, 1 + transaction.BytesRead);
+	return transaction.Status;
+}
+
+NTSTATUS FakeSpbTarget::Sequence(PVOID Input, ULONG InputLength, ULONG_PTR* BytesTransferred)
+{
+	PSPB_TRANSFER_LIST list = (PSPB_TRANSFER_LIST)Input;
+	FAKE_SPB_TRANSACTION transaction = {};
+	ULONG wireBytes = 0;
+	ULONG shortRead;
+
+	transaction.Op = FakeSpbSequence;
+	*BytesTransferred = 0;
+
+	//
+	// SpbCx rejects sequences from a client that holds the controller
+	// lock, controllers without sequence support reject all of them
+	//
+	if (!list || InputLength < sizeof(SPB_TRANSFER_LIST) || list->TransferCount == 0) {
+		transaction.Status = STATUS_INVALID_PARAMETER;
+	}
+	else if (Locked) {
+		transaction.Status = STATUS_INVALID_DEVICE_REQUEST;
+	}
+	else if (!SequenceSupported) {
+		transaction.Status = STATUS_NOT_SUPPORTED;
+	}
+	else {
+		transaction.Status = TakeFault(&shortRead);
+	}
+
+	for (ULONG i = 0; NT_SUCCESS(transaction.Status) && i < list->TransferCount; i++) {
+		const SPB_TRANSFER_LIST_ENTRY* entry = &list->Transfers[i];
+		PUCHAR buffer = (PUCHAR)entry->Buffer.Simple.Buffer;
+		ULONG length = entry->Buffer.Simple.BufferCb;
+
+		if (entry->Buffer.Format != SpbTransferBufferFormatSimple) {
+			transaction.Status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		//
+		// Each transfer after a repeated start sends the address again
+		//
+		wireBytes++;
+
+		if (entry->Direction == SpbTransferDirectionToDevice) {
+			if (!Device || !Device->Write(buffer, length)) {
+				transaction.Status = FAKE_SPB_NACK_STATUS;
+				break;
+			}
+			transaction.Written.insert(transaction.Written.end(), buffer, buffer + length);
+			wireBytes += length;
+			*BytesTransferred += length;
+		}
+		else {
+			if (shortRead)
+				length = min(length, shortRead);
+			if (MaxReadLength)
+				length = min(length, MaxReadLength);
+
+			if (!Device || !Device->Read(buffer, length)) {
+				transaction.Status = FAKE_SPB_NACK_STATUS;
+				break;
+			}
+			transaction.BytesRead += length;
+			wireBytes += length;
+			*BytesTransferred += length;
+		}
+	}
+
+	if (!NT_SUCCESS(transaction.Status))
+		*BytesTransferred = 0;
+
+	Transfer(&transaction, wireBytes);
+	return transaction.Status;
+}
+
+NTSTATUS FakeSpbTarget::Ioctl(ULONG IoControlCode, PVOID Input, ULONG InputLength, ULONG_PTR* BytesReturned)
+{
+	FAKE_SPB_TRANSACTION transaction = {};
+
+	*BytesReturned = 0;
+
+	switch (IoControlCode) {
+	case IOCTL_SPB_EXECUTE_SEQUENCE:
+		return Sequence(Input, InputLength, BytesReturned);
+
+	case IOCTL_SPB_LOCK_CONTROLLER:
+		transaction.Op = FakeSpbLock;
+		transaction.Status = Locked ? STATUS_INVALID_DEVICE_REQUEST : STATUS_SUCCESS;
+		Transfer(&transaction, 0);
+
+		if (NT_SUCCESS(transaction.Status)) {
+			Locked = TRUE;
+			LockedAt = transaction.Start;
+		}
+		return transaction.Status;
+
+	case IOCTL_SPB_UNLOCK_CONTROLLER:
+		transaction.Op = FakeSpbUnlock;
+		transaction.Status = Locked ? STATUS_SUCCESS : STATUS_INVALID_DEVICE_REQUEST;
+		Transfer(&transaction, 0);
+
+		if (NT_SUCCESS(transaction.Status)) {
+			Locked = FALSE;
+			MaxLockHold = max(MaxLockHold, transaction.End - LockedAt);
+		}
+		return transaction.Status;
+
+	default:
+		return STATUS_NOT_SUPPORTED;
+	}
+}
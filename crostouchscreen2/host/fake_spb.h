@@ -0,0 +1,142 @@
+/*++
+
+Module Name:
+
+fake_spb.h
+
+Abstract:
+
+In-memory SPB I2C controller that the shim's WDF I/O target forwards
+to. It times each request on the virtual clock, injects NACKs, errors
+and short reads, and keeps a timestamped log of every request so tests
+can count transactions, bus bytes and lock hold times.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <wdm.h>
+
+//
+// The peripheral on the bus. Returning false NACKs the transfer.
+//
+class FakeI2cDevice
+{
+public:
+	virtual ~FakeI2cDevice() {}
+
+	virtual bool Write(const UINT8* Data, ULONG Length) = 0;
+
+	virtual bool Read(UINT8* Data, ULONG Length) = 0;
+};
+
+typedef enum _FAKE_SPB_OP {
+	FakeSpbWrite,
+	FakeSpbRead,
+	FakeSpbSequence,
+	FakeSpbLock,
+	FakeSpbUnlock
+} FAKE_SPB_OP;
+
+typedef struct _FAKE_SPB_TRANSACTION {
+	FAKE_SPB_OP Op;
+	LONGLONG Start;
+	LONGLONG End;
+	NTSTATUS Status;
+	BOOLEAN ControllerLocked;
+
+	//
+	// Bytes sent to the device, in bus order, and bytes read back
+	//
+	std::vector<UINT8> Written;
+	ULONG BytesRead;
+} FAKE_SPB_TRANSACTION;
+
+//
+// Status SpbCx completes a request with when the address is NACKed
+//
+#define FAKE_SPB_NACK_STATUS	STATUS_NO_SUCH_DEVICE
+
+class FakeSpbTarget
+{
+public:
+	FakeI2cDevice* Device = nullptr;
+
+	//
+	// Every request costs RequestLatencyUs going through the SPB stack,
+	// plus ByteTimeNs for each byte on the wire including the address
+	// byte of each segment. 400 kHz I2C moves a byte in 22500 ns.
+	//
+	ULONG RequestLatencyUs = 0;
+	ULONG ByteTimeNs = 0;
+
+	//
+	// Controller capabilities. SpbCx rejects a sequence sent while the
+	// client holds the controller lock, and a controller without sequence
+	// support fails them with STATUS_NOT_SUPPORTED. Reads longer than a
+	// non-zero MaxReadLength come back short.
+	//
+	bool SequenceSupported = true;
+	ULONG MaxReadLength = 0;
+
+	//
+	// Called before each data transfer, with the transfer's index among
+	// the data transfers since the log was last cleared
+	//
+	std::function<void(ULONG Index)> BeforeTransfer;
+
+	std::vector<FAKE_SPB_TRANSACTION> Log;
+
+	//
+	// Faults for the next data transfers, applied in the order queued
+	//
+	void FailNext(NTSTATUS Status, ULONG Count = 1);
+	void NackNext(ULONG Count = 1);
+	void ShortReadNext(ULONG Bytes, ULONG Count = 1);
+
+	//
+	// NACK each data transfer with the given probability
+	//
+	void SetRandomNacks(ULONG PerThousand, ULONG Seed);
+
+	void ClearLog();
+	ULONG Count(FAKE_SPB_OP Op) const;
+	ULONG DataTransfers() const;
+	ULONG BusBytes() const;
+	LONGLONG BusTime() const;
+	LONGLONG MaxControllerLockHold() const;
+	BOOLEAN ControllerLocked() const { return Locked; }
+
+	//
+	// Entry points for the WDF shim
+	//
+	NTSTATUS Write(const UINT8* Data, ULONG Length, ULONG_PTR* BytesWritten);
+	NTSTATUS Read(UINT8* Data, ULONG Length, ULONG_PTR* BytesRead);
+	NTSTATUS Ioctl(ULONG IoControlCode, PVOID Input, ULONG InputLength, ULONG_PTR* BytesReturned);
+
+private:
+	struct Fault {
+		NTSTATUS Status;
+		ULONG ShortRead;
+	};
+
+	NTSTATUS TakeFault(ULONG* ShortRead);
+	NTSTATUS Sequence(PVOID Input, ULONG InputLength, ULONG_PTR* BytesTransferred);
+	void Transfer(FAKE_SPB_TRANSACTION* Transaction, ULONG WireBytes);
+
+	std::deque<Fault> Faults;
+	ULONG RandomNacks = 0;
+	ULONG RandomSeed = 0;
+	ULONG TransferIndex = 0;
+	BOOLEAN Locked = FALSE;
+	LONGLONG LockedAt = 0;
+	LONGLONG MaxLockHold = 0;
+};
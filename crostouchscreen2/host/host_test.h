@@ -0,0 +1,60 @@
+/*++
+
+Module Name:
+
+host_test.h
+
+Abstract:
+
+Minimal test registry for the host tests. Each TEST runs on a freshly
+reset shim; failed expectations are printed and fail the executable.
+REPORT prints the measurements a test was written to produce, so a
+ctest run with --verbose doubles as the performance report.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <stdio.h>
+
+typedef void (*HOST_TEST_ROUTINE)(void);
+
+int HostTestRegister(const char* Name, HOST_TEST_ROUTINE Routine);
+void HostTestFail(const char* File, int Line, const char* Format, ...);
+
+#define TEST(_name) \
+	static void _name(void); \
+	static int _name##_registered = HostTestRegister(#_name, _name); \
+	static void _name(void)
+
+#define EXPECT(_cond) \
+	do { \
+		if (!(_cond)) \
+			HostTestFail(__FILE__, __LINE__, "%s", #_cond); \
+	} while (0)
+
+#define HOST_TEST_COMPARE(_a, _op, _b) \
+	do { \
+		long long _va = (long long)(_a); \
+		long long _vb = (long long)(_b); \
+		if (!(_va _op _vb)) \
+			HostTestFail(__FILE__, __LINE__, "%s %s %s (%lld vs %lld)", #_a, #_op, #_b, _va, _vb); \
+	} while (0)
+
+#define EXPECT_EQ(_a, _b)	HOST_TEST_COMPARE(_a, ==, _b)
+#define EXPECT_NE(_a, _b)	HOST_TEST_COMPARE(_a, !=, _b)
+#define EXPECT_LT(_a, _b)	HOST_TEST_COMPARE(_a, <, _b)
+#define EXPECT_LE(_a, _b)	HOST_TEST_COMPARE(_a, <=, _b)
+#define EXPECT_GT(_a, _b)	HOST_TEST_COMPARE(_a, >, _b)
+#define EXPECT_GE(_a, _b)	HOST_TEST_COMPARE(_a, >=, _b)
+
+#define REPORT(...) \
+	do { \
+		printf("    "); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} while (0)
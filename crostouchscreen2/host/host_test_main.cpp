@@ -0,0 +1,94 @@
+/*++
+
+Module Name:
+
+host_test_main.cpp
+
+Abstract:
+
+Runs the registered host tests. An argument restricts the run to the
+tests whose name contains it.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <vector>
+
+#include "host_test.h"
+#include "wdf_shim.h"
+
+struct HostTest {
+	const char* Name;
+	HOST_TEST_ROUTINE Routine;
+};
+
+static std::vector<HostTest>& HostTests()
+{
+	static std::vector<HostTest> tests;
+	return tests;
+}
+
+static int g_Failures;
+
+int HostTestRegister(const char* Name, HOST_TEST_ROUTINE Routine)
+{
+	HostTests().push_back({ Name, Routine });
+	return 0;
+}
+
+void HostTestFail(const char* File, int Line, const char* Format, ...)
+{
+	va_list args;
+
+	printf("    %s:%d: FAILED: ", File, Line);
+
+	va_start(args, Format);
+	vprintf(Format, args);
+	va_end(args);
+
+	printf("\n");
+	g_Failures++;
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = argc > 1 ? argv[1] : NULL;
+	int failed = 0;
+	int run = 0;
+
+	for (const HostTest& test : HostTests()) {
+		int failures = g_Failures;
+
+		if (filter && !strstr(test.Name, filter))
+			continue;
+
+		printf("[ RUN  ] %s\n", test.Name);
+		fflush(stdout);
+
+		ShimReset();
+		test.Routine();
+		ShimJoinThreads();
+
+		if (g_Failures != failures) {
+			printf("[ FAIL ] %s\n", test.Name);
+			failed++;
+		}
+		else {
+			printf("[  OK  ] %s\n", test.Name);
+		}
+
+		run++;
+	}
+
+	ShimReset();
+
+	printf("%d of %d tests passed\n", run - failed, run);
+
+	return failed ? 1 : 0;
+}
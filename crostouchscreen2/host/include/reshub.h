@@ -0,0 +1,24 @@
+/*++
+
+Module Name:
+
+reshub.h
+
+Abstract:
+
+Host build stand-in for the resource hub path helpers.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+#define RESOURCE_HUB_PATH_CHARS	64
+#define RESOURCE_HUB_PATH_SIZE	(RESOURCE_HUB_PATH_CHARS * sizeof(WCHAR))
+
+NTSTATUS RESOURCE_HUB_CREATE_PATH_FROM_ID(PUNICODE_STRING DevicePath, ULONG IdLowPart, ULONG IdHighPart);
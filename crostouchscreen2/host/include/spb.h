@@ -0,0 +1,96 @@
+/*++
+
+Module Name:
+
+spb.h
+
+Abstract:
+
+Host build stand-in for the SPB client interface: the controller
+IOCTLs and the transfer list sent with IOCTL_SPB_EXECUTE_SEQUENCE.
+The IOCTL values only need to be distinct on the host.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+#define SPB_IOCTL(id)	CTL_CODE(FILE_DEVICE_CONTROLLER, (id), METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define IOCTL_SPB_LOCK_CONTROLLER		SPB_IOCTL(0x10)
+#define IOCTL_SPB_UNLOCK_CONTROLLER		SPB_IOCTL(0x11)
+#define IOCTL_SPB_EXECUTE_SEQUENCE		SPB_IOCTL(0x12)
+#define IOCTL_SPB_LOCK_CONNECTION		SPB_IOCTL(0x13)
+#define IOCTL_SPB_UNLOCK_CONNECTION		SPB_IOCTL(0x14)
+#define IOCTL_SPB_FULL_DUPLEX			SPB_IOCTL(0x15)
+
+typedef enum _SPB_TRANSFER_DIRECTION {
+	SpbTransferDirectionNone,
+	SpbTransferDirectionFromDevice,
+	SpbTransferDirectionToDevice,
+	SpbTransferDirectionMax
+} SPB_TRANSFER_DIRECTION;
+
+typedef enum _SPB_TRANSFER_BUFFER_FORMAT {
+	SpbTransferBufferFormatInvalid,
+	SpbTransferBufferFormatSimple,
+	SpbTransferBufferFormatList,
+	SpbTransferBufferFormatSimpleNonPaged,
+	SpbTransferBufferFormatMdl,
+	SpbTransferBufferFormatMax
+} SPB_TRANSFER_BUFFER_FORMAT;
+
+typedef struct _SPB_TRANSFER_BUFFER {
+	SPB_TRANSFER_BUFFER_FORMAT Format;
+	union {
+		struct {
+			PVOID Buffer;
+			ULONG BufferCb;
+		} Simple;
+	};
+} SPB_TRANSFER_BUFFER, *PSPB_TRANSFER_BUFFER;
+
+typedef struct _SPB_TRANSFER_LIST_ENTRY {
+	SPB_TRANSFER_DIRECTION Direction;
+	ULONG DelayInUs;
+	SPB_TRANSFER_BUFFER Buffer;
+} SPB_TRANSFER_LIST_ENTRY, *PSPB_TRANSFER_LIST_ENTRY;
+
+typedef struct _SPB_TRANSFER_LIST {
+	ULONG Size;
+	ULONG Reserved;
+	ULONG TransferCount;
+	SPB_TRANSFER_LIST_ENTRY Transfers[1];
+} SPB_TRANSFER_LIST, *PSPB_TRANSFER_LIST;
+
+#define SPB_TRANSFER_LIST_AND_ENTRIES(n) \
+	struct { \
+		SPB_TRANSFER_LIST List; \
+		SPB_TRANSFER_LIST_ENTRY ExtraTransfers[(n) - 1]; \
+	}
+
+inline VOID SPB_TRANSFER_LIST_INIT(PSPB_TRANSFER_LIST List, ULONG TransferCount)
+{
+	List->Size = sizeof(SPB_TRANSFER_LIST);
+	List->Reserved = 0;
+	List->TransferCount = TransferCount;
+}
+
+inline SPB_TRANSFER_LIST_ENTRY SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(SPB_TRANSFER_DIRECTION Direction, ULONG DelayInUs, PVOID Buffer, ULONG BufferCb)
+{
+	SPB_TRANSFER_LIST_ENTRY entry;
+
+	RtlZeroMemory(&entry, sizeof(entry));
+	entry.Direction = Direction;
+	entry.DelayInUs = DelayInUs;
+	entry.Buffer.Format = SpbTransferBufferFormatSimple;
+	entry.Buffer.Simple.Buffer = Buffer;
+	entry.Buffer.Simple.BufferCb = BufferCb;
+
+	return entry;
+}
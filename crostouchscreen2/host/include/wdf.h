@@ -0,0 +1,373 @@
+/*++
+
+Module Name:
+
+wdf.h
+
+Abstract:
+
+Host build stand-in for the KMDF headers. Declares the framework
+objects, configuration structures and methods the driver uses. The
+objects are implemented in wdf_shim.cpp, and I/O targets forward to the
+fake SPB controller in fake_spb.h.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+
+//
+// Framework object handles
+//
+typedef void* WDFOBJECT;
+
+typedef struct WDFDRIVER__* WDFDRIVER;
+typedef struct WDFDEVICE__* WDFDEVICE;
+typedef struct WDFQUEUE__* WDFQUEUE;
+typedef struct WDFREQUEST__* WDFREQUEST;
+typedef struct WDFMEMORY__* WDFMEMORY;
+typedef struct WDFIOTARGET__* WDFIOTARGET;
+typedef struct WDFWAITLOCK__* WDFWAITLOCK;
+typedef struct WDFSPINLOCK__* WDFSPINLOCK;
+typedef struct WDFINTERRUPT__* WDFINTERRUPT;
+typedef struct WDFWORKITEM__* WDFWORKITEM;
+typedef struct WDFKEY__* WDFKEY;
+typedef struct WDFCMRESLIST__* WDFCMRESLIST;
+typedef struct WDFDEVICE_INIT* PWDFDEVICE_INIT;
+
+#define WDF_NO_OBJECT_ATTRIBUTES	NULL
+#define WDF_NO_HANDLE				NULL
+
+typedef enum _WDF_TRI_STATE {
+	WdfFalse = FALSE,
+	WdfTrue = TRUE,
+	WdfUseDefault = 2
+} WDF_TRI_STATE;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES {
+	ULONG Size;
+	WDFOBJECT ParentObject;
+	size_t ContextSize;
+} WDF_OBJECT_ATTRIBUTES, *PWDF_OBJECT_ATTRIBUTES;
+
+inline VOID WDF_OBJECT_ATTRIBUTES_INIT(PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+	RtlZeroMemory(Attributes, sizeof(WDF_OBJECT_ATTRIBUTES));
+	Attributes->Size = sizeof(WDF_OBJECT_ATTRIBUTES);
+}
+
+#define WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(_attributes, _contexttype) \
+	(WDF_OBJECT_ATTRIBUTES_INIT(_attributes), (_attributes)->ContextSize = sizeof(_contexttype))
+
+PVOID ShimObjectGetContext(WDFOBJECT Handle);
+
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, _castingfunction) \
+	inline _contexttype* _castingfunction(WDFOBJECT Handle) \
+	{ \
+		return (_contexttype*)ShimObjectGetContext(Handle); \
+	}
+
+VOID WdfObjectDelete(WDFOBJECT Object);
+
+//
+// Event callback types
+//
+typedef enum _WDF_POWER_DEVICE_STATE {
+	WdfPowerDeviceInvalid = 0,
+	WdfPowerDeviceD0,
+	WdfPowerDeviceD1,
+	WdfPowerDeviceD2,
+	WdfPowerDeviceD3,
+	WdfPowerDeviceD3Final,
+	WdfPowerDevicePrepareForHibernation,
+	WdfPowerDeviceMaximum
+} WDF_POWER_DEVICE_STATE;
+
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PWDFDEVICE_INIT DeviceInit);
+typedef EVT_WDF_DRIVER_DEVICE_ADD* PFN_WDF_DRIVER_DEVICE_ADD;
+
+typedef VOID EVT_WDF_DRIVER_UNLOAD(WDFDRIVER Driver);
+typedef EVT_WDF_DRIVER_UNLOAD* PFN_WDF_DRIVER_UNLOAD;
+
+typedef NTSTATUS EVT_WDFDEVICE_WDM_IRP_PREPROCESS(WDFDEVICE Device, PIRP Irp);
+
+typedef NTSTATUS EVT_WDF_DEVICE_PREPARE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesRaw, WDFCMRESLIST ResourcesTranslated);
+typedef EVT_WDF_DEVICE_PREPARE_HARDWARE* PFN_WDF_DEVICE_PREPARE_HARDWARE;
+
+typedef NTSTATUS EVT_WDF_DEVICE_RELEASE_HARDWARE(WDFDEVICE Device, WDFCMRESLIST ResourcesTranslated);
+typedef EVT_WDF_DEVICE_RELEASE_HARDWARE* PFN_WDF_DEVICE_RELEASE_HARDWARE;
+
+typedef NTSTATUS EVT_WDF_DEVICE_D0_ENTRY(WDFDEVICE Device, WDF_POWER_DEVICE_STATE PreviousState);
+typedef EVT_WDF_DEVICE_D0_ENTRY* PFN_WDF_DEVICE_D0_ENTRY;
+
+typedef NTSTATUS EVT_WDF_DEVICE_D0_EXIT(WDFDEVICE Device, WDF_POWER_DEVICE_STATE TargetState);
+typedef EVT_WDF_DEVICE_D0_EXIT* PFN_WDF_DEVICE_D0_EXIT;
+
+typedef VOID EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL(WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength, size_t InputBufferLength, ULONG IoControlCode);
+typedef EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL* PFN_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL;
+
+typedef BOOLEAN EVT_WDF_INTERRUPT_ISR(WDFINTERRUPT Interrupt, ULONG MessageID);
+typedef EVT_WDF_INTERRUPT_ISR* PFN_WDF_INTERRUPT_ISR;
+
+typedef VOID EVT_WDF_INTERRUPT_DPC(WDFINTERRUPT Interrupt, WDFOBJECT AssociatedObject);
+typedef EVT_WDF_INTERRUPT_DPC* PFN_WDF_INTERRUPT_DPC;
+
+typedef VOID EVT_WDF_INTERRUPT_WORKITEM(WDFINTERRUPT Interrupt, WDFOBJECT AssociatedObject);
+typedef EVT_WDF_INTERRUPT_WORKITEM* PFN_WDF_INTERRUPT_WORKITEM;
+
+typedef VOID EVT_WDF_WORKITEM(WDFWORKITEM WorkItem);
+typedef EVT_WDF_WORKITEM* PFN_WDF_WORKITEM;
+
+//
+// Driver
+//
+typedef struct _WDF_DRIVER_CONFIG {
+	ULONG Size;
+	PFN_WDF_DRIVER_DEVICE_ADD EvtDriverDeviceAdd;
+	PFN_WDF_DRIVER_UNLOAD EvtDriverUnload;
+} WDF_DRIVER_CONFIG, *PWDF_DRIVER_CONFIG;
+
+inline VOID WDF_DRIVER_CONFIG_INIT(PWDF_DRIVER_CONFIG Config, PFN_WDF_DRIVER_DEVICE_ADD EvtDriverDeviceAdd)
+{
+	RtlZeroMemory(Config, sizeof(WDF_DRIVER_CONFIG));
+	Config->Size = sizeof(WDF_DRIVER_CONFIG);
+	Config->EvtDriverDeviceAdd = EvtDriverDeviceAdd;
+}
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath, PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig, WDFDRIVER* Driver);
+
+//
+// Device
+//
+typedef struct _WDF_PNPPOWER_EVENT_CALLBACKS {
+	ULONG Size;
+	PFN_WDF_DEVICE_D0_ENTRY EvtDeviceD0Entry;
+	PFN_WDF_DEVICE_D0_EXIT EvtDeviceD0Exit;
+	PFN_WDF_DEVICE_PREPARE_HARDWARE EvtDevicePrepareHardware;
+	PFN_WDF_DEVICE_RELEASE_HARDWARE EvtDeviceReleaseHardware;
+} WDF_PNPPOWER_EVENT_CALLBACKS, *PWDF_PNPPOWER_EVENT_CALLBACKS;
+
+inline VOID WDF_PNPPOWER_EVENT_CALLBACKS_INIT(PWDF_PNPPOWER_EVENT_CALLBACKS Callbacks)
+{
+	RtlZeroMemory(Callbacks, sizeof(WDF_PNPPOWER_EVENT_CALLBACKS));
+	Callbacks->Size = sizeof(WDF_PNPPOWER_EVENT_CALLBACKS);
+}
+
+typedef enum _WDF_DEVICE_FAILED_ACTION {
+	WdfDeviceFailedUndefined = 0,
+	WdfDeviceFailedAttemptRestart,
+	WdfDeviceFailedNoRestart
+} WDF_DEVICE_FAILED_ACTION;
+
+VOID WdfFdoInitSetFilter(PWDFDEVICE_INIT DeviceInit);
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT DeviceInit, PWDF_PNPPOWER_EVENT_CALLBACKS PnpPowerEventCallbacks);
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes, WDFDEVICE* Device);
+VOID WdfDeviceSetFailed(WDFDEVICE Device, WDF_DEVICE_FAILED_ACTION FailedAction);
+
+//
+// Registry
+//
+#define PLUGPLAY_REGKEY_DEVICE	1
+
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE Device, ULONG DeviceInstanceKeyType, ACCESS_MASK DesiredAccess, PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key);
+NTSTATUS WdfRegistryOpenKey(WDFKEY ParentKey, PCUNICODE_STRING KeyName, ACCESS_MASK DesiredAccess, PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key);
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG Value);
+VOID WdfRegistryClose(WDFKEY Key);
+
+//
+// Resources
+//
+ULONG WdfCmResourceListGetCount(WDFCMRESLIST List);
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(WDFCMRESLIST List, ULONG Index);
+
+//
+// Memory
+//
+typedef enum _WDF_MEMORY_DESCRIPTOR_TYPE {
+	WdfMemoryDescriptorTypeInvalid = 0,
+	WdfMemoryDescriptorTypeBuffer,
+	WdfMemoryDescriptorTypeMdl,
+	WdfMemoryDescriptorTypeHandle
+} WDF_MEMORY_DESCRIPTOR_TYPE;
+
+typedef struct _WDF_MEMORY_DESCRIPTOR {
+	WDF_MEMORY_DESCRIPTOR_TYPE Type;
+	union {
+		struct {
+			PVOID Buffer;
+			ULONG Length;
+		} BufferType;
+	} u;
+} WDF_MEMORY_DESCRIPTOR, *PWDF_MEMORY_DESCRIPTOR;
+
+inline VOID WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(PWDF_MEMORY_DESCRIPTOR Descriptor, PVOID Buffer, ULONG BufferLength)
+{
+	RtlZeroMemory(Descriptor, sizeof(WDF_MEMORY_DESCRIPTOR));
+	Descriptor->Type = WdfMemoryDescriptorTypeBuffer;
+	Descriptor->u.BufferType.Buffer = Buffer;
+	Descriptor->u.BufferType.Length = BufferLength;
+}
+
+NTSTATUS WdfMemoryCreate(PWDF_OBJECT_ATTRIBUTES Attributes, POOL_TYPE PoolType, ULONG PoolTag, size_t BufferSize, WDFMEMORY* Memory, PVOID* Buffer);
+PVOID WdfMemoryGetBuffer(WDFMEMORY Memory, size_t* BufferSize);
+NTSTATUS WdfMemoryCopyFromBuffer(WDFMEMORY DestinationMemory, size_t DestinationOffset, PVOID Buffer, size_t NumBytesToCopyFrom);
+
+//
+// I/O targets
+//
+typedef enum _WDF_IO_TARGET_OPEN_TYPE {
+	WdfIoTargetOpenUndefined = 0,
+	WdfIoTargetOpenUseExistingDevice,
+	WdfIoTargetOpenByName
+} WDF_IO_TARGET_OPEN_TYPE;
+
+typedef struct _WDF_IO_TARGET_OPEN_PARAMS {
+	ULONG Size;
+	WDF_IO_TARGET_OPEN_TYPE Type;
+	UNICODE_STRING TargetDeviceName;
+	ACCESS_MASK DesiredAccess;
+	ULONG ShareAccess;
+	ULONG FileAttributes;
+	ULONG CreateDisposition;
+} WDF_IO_TARGET_OPEN_PARAMS, *PWDF_IO_TARGET_OPEN_PARAMS;
+
+inline VOID WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(PWDF_IO_TARGET_OPEN_PARAMS Params, PCUNICODE_STRING TargetDeviceName, ACCESS_MASK DesiredAccess)
+{
+	RtlZeroMemory(Params, sizeof(WDF_IO_TARGET_OPEN_PARAMS));
+	Params->Size = sizeof(WDF_IO_TARGET_OPEN_PARAMS);
+	Params->Type = WdfIoTargetOpenByName;
+	Params->TargetDeviceName = *TargetDeviceName;
+	Params->DesiredAccess = DesiredAccess;
+	Params->CreateDisposition = FILE_OPEN;
+	Params->FileAttributes = FILE_ATTRIBUTE_NORMAL;
+}
+
+typedef struct _WDF_REQUEST_SEND_OPTIONS* PWDF_REQUEST_SEND_OPTIONS;
+
+NTSTATUS WdfIoTargetCreate(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES IoTargetAttributes, WDFIOTARGET* IoTarget);
+NTSTATUS WdfIoTargetOpen(WDFIOTARGET IoTarget, PWDF_IO_TARGET_OPEN_PARAMS OpenParams);
+NTSTATUS WdfIoTargetSendWriteSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, PWDF_MEMORY_DESCRIPTOR InputBuffer, PLONGLONG DeviceOffset, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesWritten);
+NTSTATUS WdfIoTargetSendReadSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, PWDF_MEMORY_DESCRIPTOR OutputBuffer, PLONGLONG DeviceOffset, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesRead);
+NTSTATUS WdfIoTargetSendIoctlSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, ULONG IoctlCode, PWDF_MEMORY_DESCRIPTOR InputBuffer, PWDF_MEMORY_DESCRIPTOR OutputBuffer, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesReturned);
+
+//
+// Synchronization
+//
+NTSTATUS WdfWaitLockCreate(PWDF_OBJECT_ATTRIBUTES LockAttributes, WDFWAITLOCK* Lock);
+NTSTATUS WdfWaitLockAcquire(WDFWAITLOCK Lock, PLONGLONG Timeout);
+VOID WdfWaitLockRelease(WDFWAITLOCK Lock);
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock);
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock);
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock);
+
+//
+// Queues and requests
+//
+typedef enum _WDF_IO_QUEUE_DISPATCH_TYPE {
+	WdfIoQueueDispatchInvalid = 0,
+	WdfIoQueueDispatchSequential,
+	WdfIoQueueDispatchParallel,
+	WdfIoQueueDispatchManual
+} WDF_IO_QUEUE_DISPATCH_TYPE;
+
+typedef struct _WDF_IO_QUEUE_CONFIG {
+	ULONG Size;
+	WDF_IO_QUEUE_DISPATCH_TYPE DispatchType;
+	WDF_TRI_STATE PowerManaged;
+	BOOLEAN DefaultQueue;
+	PFN_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL EvtIoInternalDeviceControl;
+} WDF_IO_QUEUE_CONFIG, *PWDF_IO_QUEUE_CONFIG;
+
+inline VOID WDF_IO_QUEUE_CONFIG_INIT(PWDF_IO_QUEUE_CONFIG Config, WDF_IO_QUEUE_DISPATCH_TYPE DispatchType)
+{
+	RtlZeroMemory(Config, sizeof(WDF_IO_QUEUE_CONFIG));
+	Config->Size = sizeof(WDF_IO_QUEUE_CONFIG);
+	Config->DispatchType = DispatchType;
+	Config->PowerManaged = WdfUseDefault;
+}
+
+inline VOID WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(PWDF_IO_QUEUE_CONFIG Config, WDF_IO_QUEUE_DISPATCH_TYPE DispatchType)
+{
+	WDF_IO_QUEUE_CONFIG_INIT(Config, DispatchType);
+	Config->DefaultQueue = TRUE;
+}
+
+typedef struct _WDF_REQUEST_PARAMETERS {
+	ULONG Size;
+	struct {
+		struct {
+			size_t OutputBufferLength;
+			size_t InputBufferLength;
+			ULONG IoControlCode;
+			PVOID Type3InputBuffer;
+		} DeviceIoControl;
+	} Parameters;
+} WDF_REQUEST_PARAMETERS, *PWDF_REQUEST_PARAMETERS;
+
+inline VOID WDF_REQUEST_PARAMETERS_INIT(PWDF_REQUEST_PARAMETERS Parameters)
+{
+	RtlZeroMemory(Parameters, sizeof(WDF_REQUEST_PARAMETERS));
+	Parameters->Size = sizeof(WDF_REQUEST_PARAMETERS);
+}
+
+NTSTATUS WdfIoQueueCreate(WDFDEVICE Device, PWDF_IO_QUEUE_CONFIG Config, PWDF_OBJECT_ATTRIBUTES QueueAttributes, WDFQUEUE* Queue);
+NTSTATUS WdfIoQueueRetrieveNextRequest(WDFQUEUE Queue, WDFREQUEST* OutRequest);
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE Queue);
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* Buffer, size_t* Length);
+NTSTATUS WdfRequestRetrieveOutputMemory(WDFREQUEST Request, WDFMEMORY* Memory);
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status);
+VOID WdfRequestCompleteWithInformation(WDFREQUEST Request, NTSTATUS Status, ULONG_PTR Information);
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information);
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST Request, WDFQUEUE DestinationQueue);
+VOID WdfRequestGetParameters(WDFREQUEST Request, PWDF_REQUEST_PARAMETERS Parameters);
+PIRP WdfRequestWdmGetIrp(WDFREQUEST Request);
+
+//
+// Interrupts and work items
+//
+typedef struct _WDF_INTERRUPT_CONFIG {
+	ULONG Size;
+	BOOLEAN ShareVector;
+	BOOLEAN FloatingSave;
+	BOOLEAN AutomaticSerialization;
+	PFN_WDF_INTERRUPT_ISR EvtInterruptIsr;
+	PFN_WDF_INTERRUPT_DPC EvtInterruptDpc;
+	BOOLEAN PassiveHandling;
+	PFN_WDF_INTERRUPT_WORKITEM EvtInterruptWorkItem;
+} WDF_INTERRUPT_CONFIG, *PWDF_INTERRUPT_CONFIG;
+
+inline VOID WDF_INTERRUPT_CONFIG_INIT(PWDF_INTERRUPT_CONFIG Configuration, PFN_WDF_INTERRUPT_ISR EvtInterruptIsr, PFN_WDF_INTERRUPT_DPC EvtInterruptDpc)
+{
+	RtlZeroMemory(Configuration, sizeof(WDF_INTERRUPT_CONFIG));
+	Configuration->Size = sizeof(WDF_INTERRUPT_CONFIG);
+	Configuration->EvtInterruptIsr = EvtInterruptIsr;
+	Configuration->EvtInterruptDpc = EvtInterruptDpc;
+}
+
+NTSTATUS WdfInterruptCreate(WDFDEVICE Device, PWDF_INTERRUPT_CONFIG Configuration, PWDF_OBJECT_ATTRIBUTES Attributes, WDFINTERRUPT* Interrupt);
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt);
+BOOLEAN WdfInterruptQueueWorkItemForIsr(WDFINTERRUPT Interrupt);
+
+typedef struct _WDF_WORKITEM_CONFIG {
+	ULONG Size;
+	PFN_WDF_WORKITEM EvtWorkItemFunc;
+	BOOLEAN AutomaticSerialization;
+} WDF_WORKITEM_CONFIG, *PWDF_WORKITEM_CONFIG;
+
+inline VOID WDF_WORKITEM_CONFIG_INIT(PWDF_WORKITEM_CONFIG Config, PFN_WDF_WORKITEM EvtWorkItemFunc)
+{
+	RtlZeroMemory(Config, sizeof(WDF_WORKITEM_CONFIG));
+	Config->Size = sizeof(WDF_WORKITEM_CONFIG);
+	Config->EvtWorkItemFunc = EvtWorkItemFunc;
+	Config->AutomaticSerialization = TRUE;
+}
+
+NTSTATUS WdfWorkItemCreate(PWDF_WORKITEM_CONFIG Config, PWDF_OBJECT_ATTRIBUTES Attributes, WDFWORKITEM* WorkItem);
+VOID WdfWorkItemEnqueue(WDFWORKITEM WorkItem);
@@ -0,0 +1,356 @@
+/*++
+
+Module Name:
+
+wdm.h
+
+Abstract:
+
+Host build stand-in for the kernel headers. Declares the subset of the
+WDM types and routines the driver uses, implemented over the virtual
+clock and scheduler in wdf_shim.cpp.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <assert.h>
+
+//
+// Annotations
+//
+#define IN
+#define OUT
+#define OPTIONAL
+#define __in
+#define __out
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _In_reads_bytes_(x)
+#define _Out_writes_bytes_(x)
+
+#define VOID void
+#define CONST const
+#define FORCEINLINE inline
+#define NTAPI
+
+typedef void* PVOID;
+typedef char CHAR;
+typedef CHAR* PCHAR;
+typedef const CHAR* PCSTR;
+typedef unsigned char UCHAR;
+typedef UCHAR* PUCHAR;
+typedef unsigned char BYTE;
+typedef UCHAR BOOLEAN;
+typedef BOOLEAN* PBOOLEAN;
+typedef short SHORT;
+typedef unsigned short USHORT;
+typedef USHORT* PUSHORT;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef LONG* PLONG;
+typedef uint32_t ULONG;
+typedef ULONG* PULONG;
+typedef int64_t LONGLONG;
+typedef LONGLONG* PLONGLONG;
+typedef uint64_t ULONGLONG;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef ULONG_PTR* PULONG_PTR;
+typedef size_t SIZE_T;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef wchar_t WCHAR;
+typedef WCHAR* PWCH;
+typedef WCHAR* PWSTR;
+typedef const WCHAR* PCWSTR;
+typedef void* HANDLE;
+typedef LONG NTSTATUS;
+typedef ULONG ACCESS_MASK;
+typedef LONG KPRIORITY;
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAXULONG 0xffffffffUL
+#define MAXLONG 0x7fffffffL
+
+typedef union _LARGE_INTEGER {
+	struct {
+		ULONG LowPart;
+		LONG HighPart;
+	};
+	struct {
+		ULONG LowPart;
+		LONG HighPart;
+	} u;
+	LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+//
+// The DDK's min and max macros, as functions so they don't break the
+// standard library headers included after this one
+//
+template <typename A, typename B>
+constexpr auto min(A a, B b) -> decltype(a < b ? a : b)
+{
+	return a < b ? a : b;
+}
+
+template <typename A, typename B>
+constexpr auto max(A a, B b) -> decltype(a > b ? a : b)
+{
+	return a > b ? a : b;
+}
+
+#define FIELD_OFFSET(type, field) ((LONG)offsetof(type, field))
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define C_ASSERT(e) static_assert(e, #e)
+#define UNREFERENCED_PARAMETER(p) ((void)(p))
+#define PAGED_CODE()
+
+#define NT_ASSERT(e) assert(e)
+#define NT_ASSERTMSG(msg, e) assert((msg) && (e))
+
+//
+// Copies go through the shim so tests can count the bytes moved, see
+// ShimBytesCopied
+//
+VOID ShimCopyMemory(PVOID Destination, const VOID* Source, SIZE_T Length);
+
+#define RtlCopyMemory(d, s, l) ShimCopyMemory((d), (s), (l))
+#define RtlMoveMemory(d, s, l) ShimCopyMemory((d), (s), (l))
+#define RtlZeroMemory(d, l) memset((d), 0, (l))
+#define RtlFillMemory(d, l, f) memset((d), (f), (l))
+
+//
+// Status codes
+//
+#define NT_SUCCESS(s) (((NTSTATUS)(s)) >= 0)
+
+#define STATUS_SUCCESS						((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT						((NTSTATUS)0x00000102L)
+#define STATUS_DEVICE_BUSY					((NTSTATUS)0x80000011L)
+#define STATUS_NO_MORE_ENTRIES				((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL					((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED				((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER			((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE				((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST		((NTSTATUS)0xC0000010L)
+#define STATUS_NO_MEMORY					((NTSTATUS)0xC0000017L)
+#define STATUS_BUFFER_TOO_SMALL				((NTSTATUS)0xC0000023L)
+#define STATUS_CRC_ERROR					((NTSTATUS)0xC000003FL)
+#define STATUS_INSUFFICIENT_RESOURCES		((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY				((NTSTATUS)0xC00000A3L)
+#define STATUS_IO_TIMEOUT					((NTSTATUS)0xC00000B5L)
+#define STATUS_NOT_SUPPORTED				((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_DEVICE_STATE			((NTSTATUS)0xC0000184L)
+#define STATUS_DEVICE_CONFIGURATION_ERROR	((NTSTATUS)0xC0000182L)
+#define STATUS_INVALID_BUFFER_SIZE			((NTSTATUS)0xC0000206L)
+#define STATUS_NOT_FOUND					((NTSTATUS)0xC0000225L)
+#define STATUS_NO_CALLBACK_ACTIVE			((NTSTATUS)0xC0000258L)
+#define STATUS_DEVICE_PROTOCOL_ERROR		((NTSTATUS)0xC0000186L)
+
+//
+// Strings
+//
+#define UNICODE_NULL ((WCHAR)0)
+
+typedef struct _UNICODE_STRING {
+	USHORT Length;
+	USHORT MaximumLength;
+	PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define DECLARE_CONST_UNICODE_STRING(name, text) \
+	const UNICODE_STRING name = { sizeof(text) - sizeof(WCHAR), sizeof(text), (PWCH)(text) }
+
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+VOID RtlInitEmptyUnicodeString(PUNICODE_STRING DestinationString, PWCH Buffer, USHORT BufferSize);
+
+ULONG RtlRandomEx(PULONG Seed);
+
+inline ULONG RtlUlongByteSwap(ULONG Source)
+{
+	return __builtin_bswap32(Source);
+}
+
+ULONG DbgPrint(PCSTR Format, ...);
+
+//
+// Interlocked operations and bit scans
+//
+inline LONG InterlockedIncrement(volatile LONG* Addend)
+{
+	return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* Addend)
+{
+	return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchange(volatile LONG* Target, LONG Value)
+{
+	return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* Destination, LONG Exchange, LONG Comparand)
+{
+	__atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comparand;
+}
+
+inline BOOLEAN _BitScanForward(ULONG* Index, ULONG Mask)
+{
+	if (Mask == 0)
+		return FALSE;
+	*Index = (ULONG)__builtin_ctz(Mask);
+	return TRUE;
+}
+
+inline BOOLEAN _BitScanReverse(ULONG* Index, ULONG Mask)
+{
+	if (Mask == 0)
+		return FALSE;
+	*Index = 31 - (ULONG)__builtin_clz(Mask);
+	return TRUE;
+}
+
+//
+// Pool
+//
+typedef enum _POOL_TYPE {
+	NonPagedPool,
+	PagedPool
+} POOL_TYPE;
+
+typedef ULONGLONG POOL_FLAGS;
+
+#define POOL_FLAG_NON_PAGED	0x0000000000000040ULL
+#define POOL_FLAG_PAGED		0x0000000000000100ULL
+
+PVOID ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+
+//
+// Dispatcher objects and timing. Time runs on the shim's virtual clock
+// in 100ns units, so waits and delays cost no wall time.
+//
+typedef enum _EVENT_TYPE {
+	NotificationEvent,
+	SynchronizationEvent
+} EVENT_TYPE;
+
+typedef struct _KEVENT {
+	LONG Signaled;
+	EVENT_TYPE Type;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef enum _KWAIT_REASON {
+	Executive
+} KWAIT_REASON;
+
+typedef enum _MODE {
+	KernelMode,
+	UserMode
+} KPROCESSOR_MODE;
+
+#define IO_NO_INCREMENT 0
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID KeClearEvent(PRKEVENT Event);
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval);
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+ULONGLONG KeQueryInterruptTime(VOID);
+
+//
+// Driver objects and IRPs, only the fields the driver touches
+//
+typedef struct _DRIVER_OBJECT {
+	PVOID DriverExtension;
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+typedef struct _IO_STACK_LOCATION {
+	struct {
+		struct {
+			ULONG OutputBufferLength;
+			ULONG InputBufferLength;
+			ULONG IoControlCode;
+			PVOID Type3InputBuffer;
+		} DeviceIoControl;
+	} Parameters;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP {
+	PVOID UserBuffer;
+	IO_STACK_LOCATION Stack;
+} IRP, *PIRP;
+
+inline PIO_STACK_LOCATION IoGetCurrentIrpStackLocation(PIRP Irp)
+{
+	return &Irp->Stack;
+}
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define METHOD_BUFFERED		0
+#define METHOD_IN_DIRECT	1
+#define METHOD_OUT_DIRECT	2
+#define METHOD_NEITHER		3
+
+#define FILE_ANY_ACCESS		0
+#define FILE_READ_ACCESS	1
+#define FILE_WRITE_ACCESS	2
+
+#define FILE_DEVICE_KEYBOARD	0x0000000b
+#define FILE_DEVICE_CONTROLLER	0x00000004
+
+#define GENERIC_READ			0x80000000UL
+#define GENERIC_WRITE			0x40000000UL
+#define FILE_OPEN				0x00000001
+#define FILE_ATTRIBUTE_NORMAL	0x00000080
+#define KEY_READ				0x00020019
+
+//
+// Hardware resources
+//
+#define CmResourceTypeConnection				0x84
+#define CM_RESOURCE_CONNECTION_CLASS_SERIAL		0x03
+#define CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C	0x01
+
+typedef struct _CM_PARTIAL_RESOURCE_DESCRIPTOR {
+	UCHAR Type;
+	UCHAR ShareDisposition;
+	USHORT Flags;
+	union {
+		struct {
+			UCHAR Class;
+			UCHAR Type;
+			UCHAR Reserved1;
+			UCHAR Reserved2;
+			ULONG IdLowPart;
+			ULONG IdHighPart;
+		} Connection;
+	} u;
+} CM_PARTIAL_RESOURCE_DESCRIPTOR, *PCM_PARTIAL_RESOURCE_DESCRIPTOR;
@@ -0,0 +1,173 @@
+/*++
+
+Module Name:
+
+rayd_harness.h
+
+Abstract:
+
+Builds the driver into a test executable and drives it the way WDF and
+hidclass would: device add, prepare hardware, D0 transitions, interrupts
+and HID read requests, against a simulated controller on the fake SPB
+bus. The driver's static helpers are compiled into the including test,
+so tests can call the raydium_i2c_* routines directly.
+
+Include this from a single test file per executable.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <vector>
+
+#include "wdf_shim.h"
+#include "fake_spb.h"
+#include "raydium_sim.h"
+
+#include "../rayd.cpp"
+
+//
+// 400 kHz I2C, and what a request costs getting through SpbCx and the
+// controller driver
+//
+#define HARNESS_BYTE_TIME_NS		22500
+#define HARNESS_REQUEST_LATENCY_US	30
+
+class RaydHarness
+{
+public:
+	FakeSpbTarget Bus;
+	RaydiumSim Panel;
+
+	WDFDEVICE Device = NULL;
+	PRAYD_CONTEXT Context = NULL;
+
+	RaydHarness()
+	{
+		Bus.Device = &Panel;
+		Bus.ByteTimeNs = HARNESS_BYTE_TIME_NS;
+		Bus.RequestLatencyUs = HARNESS_REQUEST_LATENCY_US;
+		ShimSetSpbTarget(&Bus);
+	}
+
+	NTSTATUS Add()
+	{
+		PWDFDEVICE_INIT init = ShimCreateDeviceInit();
+		NTSTATUS status;
+
+		status = RaydEvtDeviceAdd(NULL, init);
+		if (NT_SUCCESS(status)) {
+			Device = ShimDeviceInitGetDevice(init);
+			Context = GetDeviceContext(Device);
+		}
+
+		return status;
+	}
+
+	NTSTATUS PrepareHardware()
+	{
+		WDFCMRESLIST resources = ShimCreateI2cResourceList(1, 0);
+
+		return OnPrepareHardware(Device, resources, resources);
+	}
+
+	NTSTATUS ReleaseHardware()
+	{
+		return OnReleaseHardware(Device, NULL);
+	}
+
+	NTSTATUS D0Entry()
+	{
+		return OnD0Entry(Device, WdfPowerDeviceD3);
+	}
+
+	NTSTATUS D0Exit()
+	{
+		return OnD0Exit(Device, WdfPowerDeviceD3);
+	}
+
+	//
+	// Everything up to the first frame: add, prepare hardware and D0
+	//
+	NTSTATUS Start()
+	{
+		NTSTATUS status;
+
+		status = Add();
+		if (NT_SUCCESS(status))
+			status = PrepareHardware();
+		if (NT_SUCCESS(status))
+			status = D0Entry();
+
+		return status;
+	}
+
+	BOOLEAN Interrupt()
+	{
+		return ShimTriggerInterrupt(Context->Interrupt);
+	}
+
+	//
+	// Publishes a frame on the panel and raises its interrupt
+	//
+	BOOLEAN Frame(const std::vector<SIM_CONTACT>& Contacts)
+	{
+		Panel.SetContacts(Contacts);
+		return Interrupt();
+	}
+
+	//
+	// Sends an IOCTL_HID_READ_REPORT, sized for the current report unless
+	// Length is given. The caller deletes the request.
+	//
+	WDFREQUEST ReadReport(size_t Length = 0)
+	{
+		WDFREQUEST request = ShimCreateRequest(IOCTL_HID_READ_REPORT,
+			Length ? Length : Context->ReportLength);
+
+		ShimDispatchRequest(ShimDeviceDefaultQueue(Device), request);
+		return request;
+	}
+
+	//
+	// Sends a METHOD_NEITHER request that hidclass answers from
+	// Irp->UserBuffer, such as the descriptor requests
+	//
+	WDFREQUEST Request(ULONG IoControlCode, size_t Length)
+	{
+		WDFREQUEST request = ShimCreateRequest(IoControlCode, Length);
+
+		ShimDispatchRequest(ShimDeviceDefaultQueue(Device), request);
+		return request;
+	}
+};
+
+//
+// A contact in the middle of the panel, offset by Step along the diagonal
+//
+static inline SIM_CONTACT HarnessContact(UINT8 Slot, int Step = 0)
+{
+	SIM_CONTACT contact = {};
+
+	contact.Slot = Slot;
+	contact.X = (UINT16)(200 + Slot * 100 + Step);
+	contact.Y = (UINT16)(100 + Slot * 50 + Step);
+	contact.Width = 8;
+	contact.Height = 6;
+	contact.Pressure = 40;
+	return contact;
+}
+
+static inline std::vector<SIM_CONTACT> HarnessContacts(int Count, int Step = 0)
+{
+	std::vector<SIM_CONTACT> contacts;
+
+	for (int i = 0; i < Count; i++)
+		contacts.push_back(HarnessContact((UINT8)i, Step));
+
+	return contacts;
+}
@@ -0,0 +1,864 @@
+/*++
+
+Module Name:
+
+rayd_test.cpp
+
+Abstract:
+
+Tests for the driver against the simulated controller: boot, the
+raydium_i2c_* bus helpers, the interrupt path and HID reports.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include "host_test.h"
+#include "rayd_harness.h"
+
+TEST(BootQueriesThePanel)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT(h.Context->TouchScreenBooted);
+	EXPECT_EQ(h.Context->bootMode, RAYDIUM_TS_MAIN);
+	EXPECT_EQ(h.Context->dataBankAddr, h.Panel.DataBankAddr);
+	EXPECT_EQ(h.Context->packageSize, h.Panel.PackageSize());
+	EXPECT_EQ(h.Context->contactSize, h.Panel.ContactSize);
+	EXPECT_EQ(h.Context->contactSlots, h.Panel.Slots);
+	EXPECT_EQ(h.Context->info.x_max, h.Panel.XMax);
+	EXPECT_EQ(h.Context->info.y_max, h.Panel.YMax);
+	EXPECT_EQ(h.Panel.Resets, 1);
+}
+
+TEST(BootQueryIsOneBatch)
+{
+	RaydHarness h;
+	WDFWAITLOCK lock;
+	ULONG hellos = 0;
+
+	EXPECT_EQ(h.Add(), STATUS_SUCCESS);
+	EXPECT_EQ(h.PrepareHardware(), STATUS_SUCCESS);
+
+	h.Bus.ClearLog();
+	EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+
+	//
+	// The reset and its bank switch, the hello polls including those the
+	// controller NACKs while it restarts, the three query reads and the
+	// read size probe
+	//
+	for (const FAKE_SPB_TRANSACTION& t : h.Bus.Log) {
+		if (t.Op == FakeSpbSequence &&
+			(t.Status == FAKE_SPB_NACK_STATUS || t.Written[0] == SIM_CMD_BOOT_READ))
+			hellos++;
+	}
+	EXPECT_EQ(h.Bus.DataTransfers(), 2 + hellos + 3 + RM_PROBE_READS);
+	REPORT("boot: %u bus transactions (%u hello polls), %lld us on the bus, ready after %u us", h.Bus.DataTransfers(),
+		hellos, h.Bus.BusTime() / SHIM_TICKS_PER_US, h.Context->ResetReadyUs);
+
+	//
+	// The query reads the query bank address and then the bank it points
+	// at, under one wait lock acquisition
+	//
+	lock = h.Context->I2CContext.SpbLock;
+	ShimClearWaitLockStats(lock);
+	h.Bus.ClearLog();
+
+	EXPECT_EQ(raydium_i2c_query_ts_info(h.Context), STATUS_SUCCESS);
+	EXPECT_EQ(ShimWaitLockStats(lock).Acquisitions, 1);
+	EXPECT_EQ(h.Bus.DataTransfers(), 3);
+	EXPECT_EQ(h.Bus.Count(FakeSpbLock), 0);
+	EXPECT_EQ(h.Context->info.x_max, h.Panel.XMax);
+	REPORT("query: %u bus transactions, %lld us on the bus", h.Bus.DataTransfers(), h.Bus.BusTime() / SHIM_TICKS_PER_US);
+}
+
+//
+// The reset and boot polls follow the controller, from units that answer
+// quickly to ones near the fixed delays the driver used to sleep
+//
+TEST(ReadinessPollFollowsTheController)
+{
+	static const ULONG readyUs[] = { 2000, 8000, 30000 };
+
+	for (ULONG ready : readyUs) {
+		RaydHarness h;
+
+		h.Panel.ReadyUs = ready;
+
+		EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+		EXPECT_EQ(h.Context->bootMode, RAYDIUM_TS_MAIN);
+		EXPECT_EQ(h.Context->ReadyTimeouts, 0);
+
+		//
+		// The reset's poll ends within one poll interval of the main
+		// firmware coming up, the boot poll finds it already up
+		//
+		EXPECT_GE(h.Context->ResetReadyUs, ready);
+		EXPECT_LT(h.Context->ResetReadyUs, ready + RM_READY_POLL_MAX_MS * 1000);
+		EXPECT_LT(h.Context->BootReadyUs, 2 * RM_READY_POLL_MIN_MS * 1000);
+
+		REPORT("controller ready after %5u us: reset poll %5u us, boot poll %4u us, fixed delays %u ms", ready,
+			h.Context->ResetReadyUs, h.Context->BootReadyUs, RM_RESET_DELAY_MSEC + RM_BOOT_DELAY_MS);
+	}
+}
+
+TEST(ReadinessPollTimesOutInTheBootloader)
+{
+	RaydHarness h;
+
+	//
+	// The bootloader acks but main firmware never comes up. Both polls
+	// run to their deadline and settle for the bootloader.
+	//
+	h.Panel.StayInBootloader = true;
+
+	h.Start();
+	EXPECT_EQ(h.Context->bootMode, RAYDIUM_TS_BLDR);
+	EXPECT(!h.Context->TouchScreenBooted);
+	EXPECT_EQ(h.Context->ReadyTimeouts, 2);
+	EXPECT_GE(h.Context->ResetReadyUs, RM_RESET_DELAY_MSEC * 1000);
+	EXPECT_LT(h.Context->ResetReadyUs, (RM_RESET_DELAY_MSEC + RM_READY_POLL_MAX_MS) * 1000);
+	EXPECT_GE(h.Context->BootReadyUs, RM_BOOT_DELAY_MS * 1000);
+	EXPECT_LT(h.Context->BootReadyUs, (RM_BOOT_DELAY_MS + RM_READY_POLL_MAX_MS) * 1000);
+	EXPECT_EQ(h.Context->info.x_max, 0);
+}
+
+TEST(ReadinessPollTimesOutOnASilentController)
+{
+	RaydHarness h;
+
+	//
+	// The reset goes through, then nothing answers before the deadlines
+	// and every boot attempt fails
+	//
+	h.Bus.BeforeTransfer = [&h](ULONG) {
+		if (h.Panel.Resets) {
+			h.Panel.ReadyUs = 10 * 1000 * 1000;
+			h.Panel.BootloaderUs = 0;
+		}
+	};
+
+	h.Start();
+	h.Bus.BeforeTransfer = nullptr;
+
+	EXPECT(!h.Context->TouchScreenBooted);
+	EXPECT_EQ(h.Panel.Resets, 1);
+	EXPECT_EQ(h.Context->ReadyTimeouts, 1 + RM_MAX_RETRIES);
+	EXPECT_GE(h.Context->ResetReadyUs, RM_RESET_DELAY_MSEC * 1000);
+	EXPECT_GE(h.Context->BootReadyUs, RM_BOOT_DELAY_MS * 1000);
+	EXPECT_EQ(h.Panel.InfoReads, 0);
+}
+
+TEST(I2cHelpersReachThePanel)
+{
+	RaydHarness h;
+	struct raydium_data_info dataInfo;
+	UINT8 packet[82];
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	EXPECT_EQ(raydium_i2c_read(h.Context, RM_CMD_DATA_BANK, (UINT8*)&dataInfo, sizeof(dataInfo)), STATUS_SUCCESS);
+	EXPECT_EQ(dataInfo.data_bank_addr, h.Panel.DataBankAddr);
+	EXPECT_EQ(dataInfo.pkg_size, h.Panel.PackageSize());
+
+	h.Panel.SetContacts(HarnessContacts(2));
+	EXPECT_EQ(raydium_i2c_read(h.Context, h.Panel.DataBankAddr, packet, sizeof(packet)), STATUS_SUCCESS);
+	EXPECT(memcmp(packet, h.Panel.Packet().data(), sizeof(packet)) == 0);
+
+	EXPECT_EQ(raydium_i2c_enter_sleep(h.Context), STATUS_SUCCESS);
+	EXPECT(h.Panel.Asleep());
+}
+
+TEST(FrameReachesPendingRead)
+{
+	RaydHarness h;
+	WDFREQUEST read;
+	TOUCH* touch;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	read = h.ReadReport();
+	EXPECT(!ShimRequestCompleted(read));
+
+	EXPECT(h.Frame({ HarnessContact(3) }));
+	EXPECT(ShimRequestCompleted(read));
+	EXPECT_EQ(ShimRequestStatus(read), STATUS_SUCCESS);
+	EXPECT_EQ(ShimRequestInformation(read), h.Context->ReportLength);
+
+	touch = (TOUCH*)&ShimRequestOutput(read)[1];
+	EXPECT_EQ(ShimRequestOutput(read)[0], REPORTID_MTOUCH);
+	EXPECT_EQ(touch->ContactID, 3);
+	EXPECT_EQ(touch->XValue, HarnessContact(3).X);
+	EXPECT_EQ(touch->YValue, HarnessContact(3).Y);
+	EXPECT_EQ(touch->Status, MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT);
+
+	ShimDeleteRequest(read);
+}
+
+TEST(FrameIsOneBurstRead)
+{
+	RaydHarness h;
+	WDFWAITLOCK lock;
+	ULONG bankSwitches;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	lock = h.Context->I2CContext.SpbLock;
+
+	ShimClearWaitLockStats(lock);
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(2)));
+
+	//
+	// The whole packet in one transfer under one wait lock acquisition,
+	// the register byte out and the packet back
+	//
+	EXPECT_EQ(ShimWaitLockStats(lock).Acquisitions, 1);
+	EXPECT_EQ(h.Bus.DataTransfers(), 1);
+	EXPECT_EQ(h.Bus.BusBytes(), 1 + h.Panel.PackageSize());
+	REPORT("frame: %u transactions, %u bytes, %lld us on the bus", h.Bus.DataTransfers(), h.Bus.BusBytes(),
+		h.Bus.BusTime() / SHIM_TICKS_PER_US);
+
+	//
+	// The RM_MAX_READ_SIZE chunks the packet used to be read in share
+	// the lock and a single bank switch
+	//
+	raydium_i2c_invalidate_bank(h.Context);
+	bankSwitches = h.Panel.BankSwitches;
+	ShimClearWaitLockStats(lock);
+	h.Bus.ClearLog();
+
+	EXPECT_EQ(raydium_i2c_read_frame(h.Context, h.Context->reportData[0], RM_MAX_READ_SIZE), STATUS_SUCCESS);
+	EXPECT_EQ(ShimWaitLockStats(lock).Acquisitions, 1);
+	EXPECT_EQ(h.Panel.BankSwitches - bankSwitches, 1);
+	EXPECT_EQ(h.Bus.DataTransfers(), (h.Panel.PackageSize() + RM_MAX_READ_SIZE - 1) / RM_MAX_READ_SIZE);
+	EXPECT_EQ(h.Bus.BusBytes(), sizeof(struct raydium_bank_switch_header) + h.Bus.DataTransfers() + h.Panel.PackageSize());
+	EXPECT(memcmp(h.Context->reportData[0], h.Panel.Packet().data(), h.Panel.PackageSize()) == 0);
+	REPORT("%d byte chunks: %u transactions, %u bytes, %lld us on the bus", RM_MAX_READ_SIZE, h.Bus.DataTransfers(),
+		h.Bus.BusBytes(), h.Bus.BusTime() / SHIM_TICKS_PER_US);
+}
+
+TEST(FramesAndControlTrafficDoNotAllocate)
+{
+	RaydHarness h;
+	const UINT8 soft_rst_cmd = 0x01;
+	struct raydium_data_info dataInfo;
+	ULONG pool, memory, buffers;
+	WDFREQUEST read;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	//
+	// The transport buffers were sized for the packet at boot
+	//
+	EXPECT_GE(h.Context->I2CContext.BufferSize, h.Panel.PackageSize());
+
+	pool = ShimPoolAllocations();
+	memory = ShimMemoryAllocations();
+	buffers = h.Context->I2CContext.BufferAllocations;
+
+	for (int i = 0; i < 100; i++) {
+		read = h.ReadReport();
+		EXPECT(h.Frame(HarnessContacts(1 + i % 3, i)));
+		EXPECT(ShimRequestCompleted(read));
+		ShimDeleteRequest(read);
+
+		EXPECT_EQ(raydium_i2c_read(h.Context, RM_CMD_DATA_BANK, (UINT8*)&dataInfo, sizeof(dataInfo)), STATUS_SUCCESS);
+	}
+
+	EXPECT_EQ(raydium_i2c_send(h.Context, RM_RESET_MSG_ADDR, &soft_rst_cmd, sizeof(soft_rst_cmd)), STATUS_SUCCESS);
+	h.Bus.SequenceSupported = false;
+	EXPECT_EQ(raydium_i2c_read(h.Context, RM_CMD_DATA_BANK, (UINT8*)&dataInfo, sizeof(dataInfo)), STATUS_SUCCESS);
+
+	EXPECT_EQ(ShimPoolAllocations(), pool);
+	EXPECT_EQ(ShimMemoryAllocations(), memory);
+	EXPECT_EQ(h.Context->I2CContext.BufferAllocations, buffers);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+	REPORT("100 frames: %u pool and %u memory object allocations", ShimPoolAllocations() - pool,
+		ShimMemoryAllocations() - memory);
+}
+
+TEST(IsrHoldsTheInterruptForTheBusReadOnly)
+{
+	RaydHarness h;
+	static const ULONG latencies[] = { 0, HARNESS_REQUEST_LATENCY_US, 100, 250 };
+	WDFREQUEST read;
+	LONGLONG start, hold;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	ShimDeferInterruptWorkItem(h.Context->Interrupt, TRUE);
+
+	for (ULONG latency : latencies) {
+		h.Bus.RequestLatencyUs = latency;
+		h.Bus.ClearLog();
+		read = h.ReadReport();
+
+		//
+		// Decode and reporting wait for the work item, the ISR only
+		// reads the packet
+		//
+		start = ShimNow();
+		EXPECT(h.Frame(HarnessContacts(2)));
+		hold = ShimNow() - start;
+
+		EXPECT_EQ(hold, h.Bus.BusTime());
+		EXPECT(!ShimRequestCompleted(read));
+
+		EXPECT(ShimRunInterruptWorkItem(h.Context->Interrupt));
+		EXPECT(ShimRequestCompleted(read));
+		ShimDeleteRequest(read);
+
+		//
+		// The work item overlaps the next read, so the ISR bounds the
+		// frame rate
+		//
+		if (latency == HARNESS_REQUEST_LATENCY_US)
+			EXPECT_LE(hold * 240, SHIM_PERFORMANCE_FREQUENCY);
+
+		REPORT("%u us request latency: ISR holds %lld us, up to %lld frames/s", latency, hold / SHIM_TICKS_PER_US,
+			SHIM_PERFORMANCE_FREQUENCY / hold);
+	}
+
+	EXPECT_EQ(h.Context->FramesLost, 0);
+}
+
+TEST(NewerFrameSupersedesAnUndecodedOne)
+{
+	RaydHarness h;
+	WDFREQUEST read;
+	TOUCH* touch;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	ShimDeferInterruptWorkItem(h.Context->Interrupt, TRUE);
+
+	read = h.ReadReport();
+
+	//
+	// The second frame goes into the other buffer and replaces the first
+	// before the work item gets to it
+	//
+	EXPECT(h.Frame({ HarnessContact(0, 0) }));
+	EXPECT(h.Frame({ HarnessContact(0, 5) }));
+	EXPECT_EQ(h.Context->FramesSuperseded, 1);
+
+	EXPECT(ShimRunInterruptWorkItem(h.Context->Interrupt));
+	EXPECT(!ShimRunInterruptWorkItem(h.Context->Interrupt));
+	EXPECT(ShimRequestCompleted(read));
+
+	touch = (TOUCH*)&ShimRequestOutput(read)[1];
+	EXPECT_EQ(touch->XValue, HarnessContact(0, 5).X);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+	EXPECT_EQ(h.Context->ReportRingCount, 0);
+	ShimDeleteRequest(read);
+}
+
+TEST(FrameReadIsOneUnlockedSequence)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT(!h.Context->I2CContext.SequenceUnsupported);
+
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(2)));
+
+	//
+	// The data bank stays selected from the size probe, so the frame is
+	// a single repeated-start sequence with no controller lock around it
+	//
+	EXPECT_EQ(h.Bus.Log.size(), 1);
+	EXPECT_EQ(h.Bus.Count(FakeSpbSequence), 1);
+	EXPECT_EQ(h.Bus.Log[0].Status, STATUS_SUCCESS);
+	EXPECT(!h.Bus.Log[0].ControllerLocked);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+}
+
+TEST(BankSwitchWriteLocksTheController)
+{
+	RaydHarness h;
+	const UINT8 soft_rst_cmd = 0x01;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	h.Bus.ClearLog();
+	EXPECT_EQ(raydium_i2c_send(h.Context, RM_RESET_MSG_ADDR, &soft_rst_cmd, sizeof(soft_rst_cmd)), STATUS_SUCCESS);
+
+	EXPECT_EQ(h.Bus.Count(FakeSpbLock), 1);
+	EXPECT_EQ(h.Bus.Count(FakeSpbWrite), 2);
+	EXPECT_EQ(h.Bus.Count(FakeSpbUnlock), 1);
+	EXPECT(!h.Bus.ControllerLocked());
+	EXPECT_EQ(h.Panel.Resets, 2);
+}
+
+TEST(BankSwitchesAreElidedWithinABank)
+{
+	RaydHarness h;
+	SPB_CONTEXT* spb;
+	struct raydium_info info;
+	ULONG issued, elided;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	spb = &h.Context->I2CContext;
+	EXPECT_EQ(spb->BankSwitchesIssued, h.Panel.BankSwitches);
+
+	issued = spb->BankSwitchesIssued;
+	elided = spb->BankSwitchesElided;
+
+	for (int i = 0; i < 10; i++)
+		EXPECT(h.Frame(HarnessContacts(1, i)));
+
+	EXPECT_EQ(spb->BankSwitchesIssued, issued);
+	EXPECT_EQ(spb->BankSwitchesElided - elided, 10);
+
+	//
+	// Control traffic to another bank costs a switch there and one back
+	// for the next frame
+	//
+	EXPECT_EQ(raydium_i2c_read(h.Context, h.Panel.QueryBankAddr, (UINT8*)&info, sizeof(info)), STATUS_SUCCESS);
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(spb->BankSwitchesIssued - issued, 2);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+
+	//
+	// A failed transfer forgets the bank, the retry selects it again
+	//
+	h.Bus.NackNext();
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(spb->BankSwitchesIssued - issued, 3);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+
+	EXPECT_EQ(spb->BankSwitchesIssued, h.Panel.BankSwitches);
+	REPORT("bank switches: %u issued, %u elided", spb->BankSwitchesIssued, spb->BankSwitchesElided);
+}
+
+TEST(ControllersWithoutSequencesUseSeparateTransfers)
+{
+	RaydHarness h;
+
+	h.Bus.SequenceSupported = false;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT(h.Context->I2CContext.SequenceUnsupported);
+
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(2)));
+	EXPECT_EQ(h.Bus.Count(FakeSpbSequence), 0);
+	EXPECT_EQ(h.Bus.Count(FakeSpbLock), 1);
+	EXPECT_EQ(h.Bus.Count(FakeSpbWrite), 1);
+	EXPECT_EQ(h.Bus.Count(FakeSpbRead), 1);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+}
+
+//
+// Frames lost out of Frames with the given RetryCount setting, with one
+// in twenty bus transfers NACKed
+//
+static ULONG RaydTestLostFrames(ULONG RetryCount, ULONG Frames)
+{
+	RaydHarness h;
+
+	ShimSetRegistryULong(L"RetryCount", RetryCount);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->RetryPolicy.MaxTries, RetryCount);
+
+	h.Bus.SetRandomNacks(50, 1234);
+	for (ULONG i = 0; i < Frames; i++)
+		EXPECT(h.Frame(HarnessContacts(2, i % 100)));
+
+	return h.Context->FramesLost;
+}
+
+TEST(RetriesRecoverFramesFromBusErrors)
+{
+	ULONG single = RaydTestLostFrames(1, 1000);
+	ULONG retried = RaydTestLostFrames(RM_MAX_RETRIES, 1000);
+
+	EXPECT_GT(single, 0);
+	EXPECT_LT(retried * 10, single);
+	REPORT("5%% NACKs over 1000 frames: %u lost with one try, %u with %d", single, retried, RM_MAX_RETRIES);
+}
+
+TEST(RetryResumesAtTheFailedChunk)
+{
+	RaydHarness h;
+	UINT32 secondChunk;
+	LONGLONG start;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	h.Context->ReadChunkSize = RM_MAX_READ_SIZE;
+	secondChunk = h.Panel.DataBankAddr + RM_MAX_READ_SIZE;
+
+	h.Bus.ClearLog();
+	h.Bus.BeforeTransfer = [&h](ULONG Index) {
+		if (Index == 1)
+			h.Bus.NackNext();
+	};
+
+	start = ShimNow();
+	EXPECT(h.Frame(HarnessContacts(2)));
+	h.Bus.BeforeTransfer = nullptr;
+
+	//
+	// Only the second chunk goes out again, straight away
+	//
+	EXPECT_EQ(h.Bus.DataTransfers(), 3);
+	EXPECT_EQ(h.Bus.Log[2].Written.back(), secondChunk & 0xFF);
+	EXPECT_EQ(h.Bus.Log[2].BytesRead, h.Panel.PackageSize() - RM_MAX_READ_SIZE);
+	EXPECT_EQ(ShimNow() - start, h.Bus.BusTime());
+	EXPECT_EQ(h.Context->I2CRetries, 1);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+	EXPECT_EQ(h.Context->ChecksumRereads, 0);
+}
+
+TEST(FramesGoAheadOfControlTraffic)
+{
+	RaydHarness h;
+	const LONGLONG period = SHIM_PERFORMANCE_FREQUENCY / 240;
+	const int frames = 240;
+	PRAYD_CONTEXT context;
+	bool streaming = true;
+	ULONG controlOps = 0;
+	ULONG controlFailures = 0;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	context = h.Context;
+
+	//
+	// A second of 240 Hz frames
+	//
+	ShimStartThread([&]() {
+		LONGLONG start = ShimNow();
+
+		for (int i = 0; i < frames; i++) {
+			ShimSleepUntil(start + i * period);
+			EXPECT(h.Frame(HarnessContacts(2, i % 100)));
+		}
+
+		streaming = false;
+	});
+
+	//
+	// Status reads, writes and info queries back to back while it runs
+	//
+	ShimStartThread([&]() {
+		struct raydium_data_info dataInfo;
+		const UINT8 reg = 0;
+
+		while (streaming) {
+			NTSTATUS status;
+
+			switch (controlOps % 3) {
+			case 0:
+				status = raydium_i2c_read(context, RM_CMD_DATA_BANK, (UINT8*)&dataInfo, sizeof(dataInfo));
+				break;
+			case 1:
+				status = raydium_i2c_send(context, h.Panel.QueryBankAddr, &reg, sizeof(reg));
+				break;
+			default:
+				status = raydium_i2c_query_ts_info(context);
+				break;
+			}
+
+			if (!NT_SUCCESS(status))
+				controlFailures++;
+			controlOps++;
+
+			ShimSleep(SHIM_TICKS_PER_MS / 2);
+		}
+	});
+
+	ShimJoinThreads();
+
+	EXPECT_EQ(context->FramesLost, 0);
+	EXPECT_EQ(context->FrameLockTimeouts, 0);
+	EXPECT_EQ(controlFailures, 0);
+	EXPECT_GT(controlOps, frames);
+	EXPECT_GT(context->ControlYields, 0);
+	EXPECT_LT(context->MaxFrameLockWait, RM_FRAME_LOCK_TIMEOUT_MS * SHIM_TICKS_PER_MS);
+	REPORT("%d frames at 240 Hz with %u control operations: %u dropped, worst lock wait %lld us, %u yields",
+		frames, controlOps, context->FramesLost, context->MaxFrameLockWait / SHIM_TICKS_PER_US, context->ControlYields);
+}
+
+TEST(ProbeReadsTheWholePacket)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->ReadChunkSize, h.Panel.PackageSize());
+
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(h.Bus.DataTransfers(), 1);
+}
+
+TEST(ProbeSkipsSizesTheControllerCorrupts)
+{
+	RaydHarness h;
+
+	//
+	// A read FIFO smaller than the packet pads long reads with 0xFF,
+	// which only the checksum catches
+	//
+	h.Panel.Slots = 20;
+	h.Panel.CleanReadLimit = RM_PROBE_READ_SIZE;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->ReadChunkSize, RM_PROBE_READ_SIZE);
+
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(h.Bus.DataTransfers(), 2);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+	EXPECT_EQ(h.Context->ChecksumRereads, 0);
+}
+
+TEST(ProbeFallsBackOnShortReads)
+{
+	RaydHarness h;
+
+	h.Bus.MaxReadLength = 64;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->ReadChunkSize, RM_MAX_READ_SIZE);
+
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(h.Bus.DataTransfers(), 2);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+}
+
+TEST(ChecksumFailuresFallBackToSmallReads)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->ReadChunkSize, h.Panel.PackageSize());
+
+	h.Panel.CleanReadLimit = RM_MAX_READ_SIZE;
+
+	for (int i = 0; i < RM_CHUNK_MAX_FAILURES; i++)
+		EXPECT(h.Frame(HarnessContacts(1, i)));
+
+	EXPECT_EQ(h.Context->FramesLost, RM_CHUNK_MAX_FAILURES);
+	EXPECT_EQ(h.Context->ChunkFallbacks, 1);
+	EXPECT_EQ(h.Context->ReadChunkSize, RM_MAX_READ_SIZE);
+
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(h.Context->FramesLost, RM_CHUNK_MAX_FAILURES);
+}
+
+TEST(LockContentionKeepsTheProbedSize)
+{
+	RaydHarness h;
+	WDFWAITLOCK lock;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	lock = h.Context->I2CContext.SpbLock;
+
+	//
+	// Another thread sits on the bus for longer than frame reads wait
+	//
+	ShimStartThread([lock]() {
+		WdfWaitLockAcquire(lock, NULL);
+		ShimSleep(100 * SHIM_TICKS_PER_MS);
+		WdfWaitLockRelease(lock);
+	});
+	ShimSleep(1);
+
+	for (int i = 0; i < RM_CHUNK_MAX_FAILURES + 1; i++)
+		EXPECT(h.Frame(HarnessContacts(1, i)));
+
+	EXPECT_EQ(h.Context->FramesLost, RM_CHUNK_MAX_FAILURES + 1);
+	EXPECT_GE(h.Context->FrameLockTimeouts, RM_CHUNK_MAX_FAILURES + 1);
+	EXPECT_EQ(h.Context->ChunkFailures, 0);
+	EXPECT_EQ(h.Context->ChunkFallbacks, 0);
+	EXPECT_EQ(h.Context->ReadChunkSize, h.Panel.PackageSize());
+
+	ShimJoinThreads();
+}
+
+//
+// Boots on 10 slot firmware, then resumes on firmware with Slots slots
+// and checks that hidclass ends up with a descriptor matching the
+// reports it gets
+//
+static void RaydTestResumeWithSlots(UINT8 Slots)
+{
+	RaydHarness h;
+	HID_DESCRIPTOR hidDescriptor;
+	ULONG descriptorLength;
+	std::vector<UINT8> expected;
+	WDFREQUEST request;
+	int contacts = min(Slots, 12);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->ContactCapacity, 10);
+	EXPECT_EQ(h.D0Exit(), STATUS_SUCCESS);
+
+	//
+	// Firmware updated while the device was in D3
+	//
+	h.Panel.Slots = Slots;
+
+	if (Slots == 10) {
+		EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+		EXPECT_EQ(ShimDeviceFailedAction(h.Device), WdfDeviceFailedUndefined);
+	}
+	else {
+		//
+		// The old descriptor is what hidclass has, so the stack restarts
+		// instead of sending reports of the new length
+		//
+		EXPECT_EQ(h.D0Entry(), STATUS_DEVICE_CONFIGURATION_ERROR);
+		EXPECT_EQ(ShimDeviceFailedAction(h.Device), WdfDeviceFailedAttemptRestart);
+		EXPECT(!h.Context->TouchScreenBooted);
+
+		EXPECT_EQ(h.ReleaseHardware(), STATUS_SUCCESS);
+		EXPECT_EQ(h.PrepareHardware(), STATUS_SUCCESS);
+		EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+	}
+
+	EXPECT_EQ(h.Context->ContactCapacity, Slots);
+	EXPECT_EQ(h.Context->ReportLength, FIELD_OFFSET(RaydMultiTouchReport, Touch) + Slots * sizeof(TOUCH) +
+		sizeof(RaydMultiTouchReport) - FIELD_OFFSET(RaydMultiTouchReport, ScanTime));
+
+	//
+	// What hidclass fetches on start
+	//
+	request = h.Request(IOCTL_HID_GET_DEVICE_DESCRIPTOR, sizeof(hidDescriptor));
+	EXPECT_EQ(ShimRequestStatus(request), STATUS_SUCCESS);
+	memcpy(&hidDescriptor, ShimRequestOutput(request), sizeof(hidDescriptor));
+	ShimDeleteRequest(request);
+
+	descriptorLength = hidDescriptor.DescriptorList[0].wReportLength;
+	expected.resize(RaydBuildReportDescriptor(h.Context, NULL));
+	RaydBuildReportDescriptor(h.Context, (PHID_REPORT_DESCRIPTOR)expected.data());
+	EXPECT_EQ(descriptorLength, expected.size());
+
+	request = h.Request(IOCTL_HID_GET_REPORT_DESCRIPTOR, descriptorLength);
+	EXPECT_EQ(ShimRequestStatus(request), STATUS_SUCCESS);
+	EXPECT(memcmp(ShimRequestOutput(request), expected.data(), expected.size()) == 0);
+	ShimDeleteRequest(request);
+
+	//
+	// A frame using the new slots arrives as one report of the new length
+	//
+	request = h.ReadReport();
+	EXPECT(h.Frame(HarnessContacts(contacts)));
+	EXPECT(ShimRequestCompleted(request));
+	EXPECT_EQ(ShimRequestInformation(request), h.Context->ReportLength);
+	EXPECT_EQ(ShimRequestOutput(request)[h.Context->ReportLength - 1], contacts);
+	ShimDeleteRequest(request);
+}
+
+TEST(ResumeOnFiveSlotFirmware)
+{
+	RaydTestResumeWithSlots(5);
+}
+
+TEST(ResumeOnTenSlotFirmware)
+{
+	RaydTestResumeWithSlots(10);
+}
+
+TEST(ResumeOnTwentySlotFirmware)
+{
+	RaydTestResumeWithSlots(20);
+}
+
+TEST(FastResumePollsTheControllerOnce)
+{
+	RaydHarness h;
+	ULONG hellos;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->FullResumes, 1);
+	EXPECT_EQ(h.D0Exit(), STATUS_SUCCESS);
+	EXPECT(h.Panel.Asleep());
+
+	//
+	// The controller only answers once its main firmware is up
+	//
+	h.Panel.BootloaderUs = 0;
+	hellos = h.Panel.HelloReads;
+	h.Panel.InfoReads = 0;
+	h.Bus.ClearLog();
+
+	EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->FastResumes, 1);
+	EXPECT_EQ(h.Context->FullResumes, 1);
+	EXPECT_EQ(h.Panel.InfoReads, 0);
+	EXPECT(!h.Panel.Asleep());
+
+	//
+	// The reset's poll answers for the verification, the main firmware
+	// ack is read once
+	//
+	EXPECT_EQ(h.Panel.HelloReads - hellos, 1);
+	REPORT("fast resume: %u us, %u bus transactions", h.Context->LastResumeUs, h.Bus.DataTransfers());
+}
+
+TEST(ChangedFirmwareFallsBackToFullResume)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.D0Exit(), STATUS_SUCCESS);
+
+	h.Panel.DataBankAddr = 0x20000900;
+	h.Panel.InfoReads = 0;
+
+	EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->FastResumes, 0);
+	EXPECT_EQ(h.Context->FullResumes, 2);
+	EXPECT_EQ(h.Panel.InfoReads, 1);
+	EXPECT_EQ(h.Context->dataBankAddr, 0x20000900);
+	REPORT("full resume: %u us", h.Context->LastResumeUs);
+
+	//
+	// Frames come from the new data bank
+	//
+	h.Bus.ClearLog();
+	EXPECT(h.Frame(HarnessContacts(1)));
+	EXPECT_EQ(h.Context->FramesLost, 0);
+}
+
+TEST(ResumeWithoutSleepSkipsTheQuery)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	//
+	// The sleep command was lost, the booted layout is kept without a
+	// re-query and the resume counts as fast
+	//
+	h.Bus.NackNext(RM_MAX_RETRIES);
+	EXPECT_EQ(h.D0Exit(), STATUS_SUCCESS);
+	EXPECT(!h.Panel.Asleep());
+	h.Panel.InfoReads = 0;
+
+	EXPECT_EQ(h.D0Entry(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Panel.InfoReads, 0);
+	EXPECT_EQ(h.Context->FastResumes, 1);
+	EXPECT_EQ(h.Context->FullResumes, 1);
+}
+
+TEST(ResumeIntoBootloaderFails)
+{
+	RaydHarness h;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.D0Exit(), STATUS_SUCCESS);
+
+	h.Panel.StayInBootloader = true;
+
+	EXPECT_EQ(h.D0Entry(), STATUS_INVALID_DEVICE_STATE);
+	EXPECT(!h.Context->TouchScreenBooted);
+	EXPECT_EQ(h.Context->FastResumes, 0);
+	EXPECT_EQ(h.Context->FullResumes, 1);
+}
@@ -0,0 +1,185 @@
+/*++
+
+Module Name:
+
+raydium_sim.cpp
+
+Abstract:
+
+Simulated Raydium touch controller.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include "raydium_sim.h"
+#include "wdf_shim.h"
+
+static void SimPutLe16(UINT8* Buffer, UINT16 Value)
+{
+	Buffer[0] = (UINT8)Value;
+	Buffer[1] = (UINT8)(Value >> 8);
+}
+
+static void SimPutLe32(UINT8* Buffer, UINT32 Value)
+{
+	SimPutLe16(Buffer, (UINT16)Value);
+	SimPutLe16(Buffer + 2, (UINT16)(Value >> 16));
+}
+
+RaydiumSim::RaydiumSim()
+{
+	//
+	// Powered up long before the test starts
+	//
+	ResetAt = ShimNow() - 1000 * SHIM_TICKS_PER_MS;
+	ClearContacts();
+}
+
+void RaydiumSim::SetContacts(const std::vector<SIM_CONTACT>& Contacts)
+{
+	ULONG reportSize = PackageSize() - 2;
+	UINT16 checksum = 0;
+
+	PacketData.assign(PackageSize(), 0);
+
+	for (const SIM_CONTACT& contact : Contacts) {
+		UINT8* record = &PacketData[(ULONG)contact.Slot * ContactSize];
+
+		if (contact.Slot >= Slots)
+			continue;
+
+		record[0] = 1;
+		SimPutLe16(&record[1], contact.X);
+		SimPutLe16(&record[3], contact.Y);
+		record[5] = contact.Pressure;
+		record[6] = contact.Width;
+		record[7] = contact.Height;
+	}
+
+	for (ULONG i = 0; i < reportSize; i++)
+		checksum += PacketData[i];
+	SimPutLe16(&PacketData[reportSize], checksum);
+
+	FrameSequence++;
+}
+
+void RaydiumSim::PowerOn()
+{
+	ResetAt = ShimNow();
+	Sleeping = false;
+	Bank = 0;
+	Pointer = 0;
+}
+
+bool RaydiumSim::Responding() const
+{
+	return ShimNow() >= ResetAt + (LONGLONG)(ReadyUs - BootloaderUs) * SHIM_TICKS_PER_US;
+}
+
+bool RaydiumSim::Ready() const
+{
+	return !StayInBootloader && ShimNow() >= ResetAt + (LONGLONG)ReadyUs * SHIM_TICKS_PER_US;
+}
+
+bool RaydiumSim::Write(const UINT8* Data, ULONG Length)
+{
+	if (!Responding() || Length == 0)
+		return false;
+
+	if (Data[0] == SIM_CMD_BANK_SWITCH && Length == 5) {
+		UINT32 addr = ((UINT32)Data[1] << 24) | ((UINT32)Data[2] << 16) | ((UINT32)Data[3] << 8) | Data[4];
+
+		Bank = addr & ~0xFFUL;
+		BankSwitches++;
+		return true;
+	}
+
+	Pointer = Data[0];
+
+	if (Length > 1 && Bank == SIM_RESET_BANK && Data[0] == SIM_RESET_REG && Data[1] == 0x01) {
+		Resets++;
+		PowerOn();
+	}
+	else if (Length == 5 && Data[0] == SIM_CMD_ENTER_SLEEP &&
+		Data[1] == 0x5A && Data[2] == 0xff && Data[3] == 0x00 && Data[4] == 0x0f) {
+		SleepCommands++;
+		Sleeping = true;
+	}
+
+	return true;
+}
+
+bool RaydiumSim::Read(UINT8* Data, ULONG Length)
+{
+	std::vector<UINT8> source;
+	ULONG offset = 0;
+	UINT32 addr = Bank | Pointer;
+
+	if (!Responding())
+		return false;
+
+	if (PacketData.size() != PackageSize())
+		ClearContacts();
+
+	switch (Pointer) {
+	case SIM_CMD_BOOT_READ:
+		source.assign(4, 0);
+		source[0] = Ready() ? SIM_MAIN_ACK : SIM_BOOTLOADER_ACK;
+		HelloReads++;
+		break;
+
+	case SIM_CMD_DATA_BANK:
+		source.assign(SIM_DATA_INFO_SIZE, 0);
+		SimPutLe32(&source[0], DataBankAddr);
+		source[4] = (UINT8)PackageSize();
+		source[5] = ContactSize;
+		break;
+
+	case SIM_CMD_QUERY_BANK:
+		source.assign(4, 0);
+		SimPutLe32(&source[0], QueryBankAddr);
+		break;
+
+	default:
+		if (addr >= QueryBankAddr && addr < QueryBankAddr + SIM_INFO_SIZE) {
+			source.assign(SIM_INFO_SIZE, 0);
+			SimPutLe32(&source[0], HwVersion);
+			source[4] = 1;
+			source[5] = 2;
+			SimPutLe16(&source[6], 3);
+			source[8] = 32;
+			source[9] = 18;
+			SimPutLe16(&source[10], XMax);
+			SimPutLe16(&source[12], YMax);
+			source[14] = XRes;
+			source[15] = YRes;
+			offset = addr - QueryBankAddr;
+			InfoReads++;
+		}
+		else if (addr >= DataBankAddr && addr < DataBankAddr + PackageSize()) {
+			source = PacketData;
+			offset = addr - DataBankAddr;
+			if (offset == 0)
+				PacketReads++;
+		}
+		break;
+	}
+
+	for (ULONG i = 0; i < Length; i++) {
+		if (CleanReadLimit && i >= CleanReadLimit)
+			Data[i] = 0xFF;
+		else
+			Data[i] = offset + i < source.size() ? source[offset + i] : 0;
+	}
+
+	if (offset == 0 && addr == DataBankAddr && Pointer != SIM_CMD_BOOT_READ &&
+		Length > 0 && CorruptReads) {
+		CorruptReads--;
+		Data[0] ^= 0x80;
+	}
+
+	return true;
+}
@@ -0,0 +1,129 @@
+/*++
+
+Module Name:
+
+raydium_sim.h
+
+Abstract:
+
+Simulated Raydium touch controller for the fake SPB bus. It answers
+the hello, data bank and query bank commands, serves the touch packet
+from its data bank, and models reset timing, the bootloader window and
+sleep. The protocol constants are kept here rather than taken from
+registers.h so the simulation is an independent reading of the
+protocol.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <vector>
+
+#include "fake_spb.h"
+
+#define SIM_CMD_BOOT_READ		0x44
+#define SIM_CMD_DATA_BANK		0x4D
+#define SIM_CMD_QUERY_BANK		0x2B
+#define SIM_CMD_ENTER_SLEEP		0x4E
+#define SIM_CMD_BANK_SWITCH		0xAA
+
+#define SIM_RESET_BANK			0x40000000
+#define SIM_RESET_REG			0x04
+
+#define SIM_MAIN_ACK			0x66
+#define SIM_BOOTLOADER_ACK		0x62
+
+#define SIM_INFO_SIZE			16
+#define SIM_DATA_INFO_SIZE		8
+
+typedef struct _SIM_CONTACT {
+	UINT8 Slot;
+	UINT16 X;
+	UINT16 Y;
+	UINT8 Width;
+	UINT8 Height;
+	UINT8 Pressure;
+} SIM_CONTACT;
+
+class RaydiumSim : public FakeI2cDevice
+{
+public:
+	RaydiumSim();
+
+	//
+	// Firmware layout. Bank addresses keep a zero low byte, so offsets
+	// into them never look like a command.
+	//
+	UINT32 DataBankAddr = 0x20000800;
+	UINT32 QueryBankAddr = 0x20000100;
+	UINT8 ContactSize = 8;
+	UINT8 Slots = 10;
+
+	UINT16 XMax = 1366;
+	UINT16 YMax = 768;
+	UINT8 XRes = 12;
+	UINT8 YRes = 12;
+	UINT32 HwVersion = 0x03000a0b;
+
+	//
+	// Time from reset until the hello packet shows main firmware, and how
+	// much of that the bootloader acks. Before the bootloader window the
+	// controller NACKs.
+	//
+	ULONG ReadyUs = 8000;
+	ULONG BootloaderUs = 2000;
+	bool StayInBootloader = false;
+
+	//
+	// Bytes past this offset of a single read come back as 0xFF, like a
+	// controller whose read FIFO is smaller than the transfer. Zero for
+	// no limit.
+	//
+	ULONG CleanReadLimit = 0;
+
+	//
+	// Packet reads to corrupt, counting reads starting at the packet start
+	//
+	ULONG CorruptReads = 0;
+
+	ULONG PackageSize() const { return (ULONG)Slots * ContactSize + 2; }
+
+	//
+	// Rebuilds the packet for the given contacts, with its checksum
+	//
+	void SetContacts(const std::vector<SIM_CONTACT>& Contacts);
+	void ClearContacts() { SetContacts({}); }
+	const std::vector<UINT8>& Packet() const { return PacketData; }
+
+	//
+	// Restarts the firmware as a reset does, at the current time
+	//
+	void PowerOn();
+
+	bool Asleep() const { return Sleeping; }
+	bool Ready() const;
+
+	ULONG Resets = 0;
+	ULONG SleepCommands = 0;
+	ULONG BankSwitches = 0;
+	ULONG HelloReads = 0;
+	ULONG InfoReads = 0;
+	ULONG PacketReads = 0;
+	ULONG FrameSequence = 0;
+
+	bool Write(const UINT8* Data, ULONG Length) override;
+	bool Read(UINT8* Data, ULONG Length) override;
+
+private:
+	bool Responding() const;
+
+	std::vector<UINT8> PacketData;
+	UINT32 Bank = 0;
+	UINT8 Pointer = 0;
+	LONGLONG ResetAt;
+	bool Sleeping = false;
+};
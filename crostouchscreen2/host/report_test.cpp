@@ -0,0 +1,629 @@
+/*++
+
+Module Name:
+
+report_test.cpp
+
+Abstract:
+
+Tests for the HID report path: building touch reports from decoded
+frames, handing them to pending reads or queueing them in the report
+ring until one arrives, and what is copied on the way. Also the report
+options: idle suppression, hybrid reports, scan time and prediction,
+replayed against synthetic finger traces.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <math.h>
+
+#include <chrono>
+
+#include "host_test.h"
+#include "rayd_harness.h"
+
+//
+// Runs the interrupt work item for a frame read with the work item
+// deferred, and returns the bytes it copied
+//
+static ULONGLONG ReportTestDecode(RaydHarness& h, const std::vector<SIM_CONTACT>& Contacts)
+{
+	ULONGLONG copied;
+
+	EXPECT(h.Frame(Contacts));
+
+	copied = ShimBytesCopied();
+	EXPECT(ShimRunInterruptWorkItem(h.Context->Interrupt));
+	return ShimBytesCopied() - copied;
+}
+
+TEST(PendingReadGetsTheReportInPlace)
+{
+	RaydHarness h;
+	WDFREQUEST read;
+	ULONGLONG direct, staged;
+	TOUCH* touch;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	ShimDeferInterruptWorkItem(h.Context->Interrupt, TRUE);
+
+	//
+	// With a read pending the report is built in its buffer
+	//
+	read = h.ReadReport();
+	direct = ReportTestDecode(h, HarnessContacts(2));
+	EXPECT(ShimRequestCompleted(read));
+	EXPECT_EQ(direct, 0);
+
+	touch = (TOUCH*)&ShimRequestOutput(read)[1];
+	EXPECT_EQ(touch[1].ContactID, 1);
+	EXPECT_EQ(touch[1].XValue, HarnessContact(1).X);
+	ShimDeleteRequest(read);
+
+	//
+	// Without one it goes through the report ring, and the touches are
+	// copied into the read that picks it up
+	//
+	staged = ShimBytesCopied();
+	EXPECT_EQ(ReportTestDecode(h, HarnessContacts(2, 1)), 0);
+	EXPECT_EQ(h.Context->ReportRingCount, 1);
+
+	read = h.ReadReport();
+	staged = ShimBytesCopied() - staged;
+	EXPECT(ShimRequestCompleted(read));
+	EXPECT_EQ(ShimRequestInformation(read), h.Context->ReportLength);
+	EXPECT_EQ(staged, 2 * sizeof(TOUCH));
+	ShimDeleteRequest(read);
+
+	REPORT("2 contacts: %llu bytes copied building into the read, %llu through the ring plus %zu in and out of it",
+		(unsigned long long)direct, (unsigned long long)staged, 2 * sizeof(RAYD_TOUCH_FRAME));
+}
+
+TEST(ReportPathBenchmark)
+{
+	const ULONG iterations = 20000;
+	RaydHarness h;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::duration<double, std::nano> direct(0), staged(0);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT(h.Frame(HarnessContacts(2)));
+	ShimDeleteRequest(h.ReadReport());
+
+	//
+	// The same frame reported over and over, into a read already queued
+	// or queued first and picked up by the next read. Only the driver's
+	// part is timed, not the shim's request handling.
+	//
+	for (ULONG i = 0; i < iterations; i++) {
+		WDFREQUEST read = h.ReadReport();
+
+		start = std::chrono::steady_clock::now();
+		RaydProcessInput(h.Context);
+		direct += std::chrono::steady_clock::now() - start;
+
+		EXPECT(ShimRequestCompleted(read));
+		ShimDeleteRequest(read);
+	}
+
+	for (ULONG i = 0; i < iterations; i++) {
+		WDFREQUEST read = ShimCreateRequest(IOCTL_HID_READ_REPORT, h.Context->ReportLength);
+		BOOLEAN complete = TRUE;
+
+		start = std::chrono::steady_clock::now();
+		RaydProcessInput(h.Context);
+		RaydReadReport(h.Context, read, &complete);
+		staged += std::chrono::steady_clock::now() - start;
+
+		EXPECT(complete);
+		ShimDeleteRequest(read);
+	}
+
+	EXPECT_EQ(h.Context->ReportRingCount, 0);
+	REPORT("2 contacts: %.0f ns into a pending read, %.0f ns through the ring", direct.count() / iterations,
+		staged.count() / iterations);
+}
+
+TEST(DelayedReadsKeepEveryLiftOff)
+{
+	RaydHarness h;
+	bool down[2] = { false, false };
+	bool lifted[2] = { false, false };
+	USHORT lastX[2] = { 0, 0 };
+	ULONG reports = 0;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	//
+	// Two fingers moving, the second lifts, then the first, with nobody
+	// reading for much longer than the ring holds
+	//
+	for (int i = 0; i < 20; i++)
+		EXPECT(h.Frame(HarnessContacts(2, i)));
+	for (int i = 20; i < 30; i++)
+		EXPECT(h.Frame({ HarnessContact(0, i) }));
+	EXPECT(h.Frame({}));
+
+	EXPECT_EQ(h.Context->ReportRingCount, RAYD_REPORT_RING_SIZE);
+	EXPECT_GT(h.Context->ReportsMerged, 0);
+	EXPECT_EQ(h.Context->FramesLost, 0);
+
+	for (;;) {
+		WDFREQUEST read = h.ReadReport();
+		const UCHAR* report = ShimRequestOutput(read);
+		const TOUCH* touch = (const TOUCH*)&report[1];
+
+		if (!ShimRequestCompleted(read))
+			break;
+
+		for (ULONG i = 0; i < h.Context->ContactsPerReport; i++) {
+			UCHAR id = touch[i].ContactID;
+
+			if (!(touch[i].Status & MULTI_CONFIDENCE_BIT) || id > 1)
+				continue;
+
+			if (touch[i].Status & MULTI_TIPSWITCH_BIT) {
+				EXPECT(!lifted[id]);
+				down[id] = true;
+			}
+			else {
+				lifted[id] = true;
+			}
+
+			lastX[id] = touch[i].XValue;
+		}
+
+		reports++;
+		ShimDeleteRequest(read);
+	}
+
+	EXPECT(down[0] && lifted[0]);
+	EXPECT(down[1] && lifted[1]);
+
+	//
+	// The lift-offs went out at the last position seen, the frames merged
+	// into them kept the latest position
+	//
+	EXPECT_EQ(lastX[0], HarnessContact(0, 29).X);
+	EXPECT_EQ(lastX[1], HarnessContact(1, 19).X);
+	EXPECT_EQ(h.Context->ReportRingCount, 0);
+	REPORT("31 frames without a read: %u reports delivered, %u merged, %u overflowed", reports,
+		h.Context->ReportsMerged, h.Context->ReportsOverflowed);
+}
+
+//
+// Reports delivered for a finger held still for a second of 120 Hz frames,
+// with a read always pending
+//
+static ULONG ReportTestStationaryHold(ULONG SuppressIdleReports)
+{
+	const LONGLONG period = SHIM_PERFORMANCE_FREQUENCY / 120;
+	RaydHarness h;
+	WDFREQUEST read;
+	LONGLONG start;
+	ULONG reports = 0;
+
+	ShimSetRegistryULong(L"SuppressIdleReports", SuppressIdleReports);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	read = h.ReadReport();
+	start = ShimNow();
+
+	for (int i = 0; i < 120; i++) {
+		ShimSleepUntil(start + i * period);
+		EXPECT(h.Frame({ HarnessContact(0) }));
+
+		if (ShimRequestCompleted(read)) {
+			reports++;
+			ShimDeleteRequest(read);
+			read = h.ReadReport();
+		}
+	}
+
+	//
+	// The lift-off is never suppressed
+	//
+	EXPECT(h.Frame({}));
+	EXPECT(ShimRequestCompleted(read));
+	EXPECT_EQ(((TOUCH*)&ShimRequestOutput(read)[1])->Status, MULTI_CONFIDENCE_BIT);
+	ShimDeleteRequest(read);
+
+	EXPECT_EQ(h.Context->ReportsSuppressed, 120 - reports);
+	return reports;
+}
+
+TEST(StationaryContactsOnlySendKeepAlives)
+{
+	ULONG all = ReportTestStationaryHold(0);
+	ULONG suppressed = ReportTestStationaryHold(1);
+
+	EXPECT_EQ(all, 120);
+
+	//
+	// The tip-down, then one report per keep-alive interval
+	//
+	EXPECT_LE(suppressed, 1 + 1000 / RAYD_KEEPALIVE_MS);
+	EXPECT_GE(suppressed, 1000 / RAYD_KEEPALIVE_MS - 1);
+	REPORT("1 s stationary hold at 120 Hz: %u reports, %u with suppression (%u ms keep-alive)", all, suppressed,
+		RAYD_KEEPALIVE_MS);
+}
+
+//
+// Bytes per second handed to hidclass for a second of 120 Hz frames of
+// Fingers moving contacts, with hidclass keeping a read pending
+//
+static ULONG ReportTestBytesPerSecond(ULONG ContactsPerReport, int Fingers)
+{
+	RaydHarness h;
+	WDFREQUEST read;
+	ULONG bytes = 0;
+	ULONG perFrame;
+
+	if (ContactsPerReport)
+		ShimSetRegistryULong(L"ContactsPerReport", ContactsPerReport);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	perFrame = (Fingers + h.Context->ContactsPerReport - 1) / h.Context->ContactsPerReport;
+
+	read = h.ReadReport();
+
+	for (int i = 0; i < 120; i++) {
+		ULONG frameReports = 0;
+
+		EXPECT(h.Frame(HarnessContacts(Fingers, i)));
+
+		while (ShimRequestCompleted(read)) {
+			//
+			// Only the first report of a frame carries its contact count
+			//
+			EXPECT_EQ(ShimRequestOutput(read)[h.Context->ReportLength - 1], frameReports ? 0 : Fingers);
+
+			bytes += (ULONG)ShimRequestInformation(read);
+			frameReports++;
+			ShimDeleteRequest(read);
+			read = h.ReadReport();
+		}
+
+		EXPECT_EQ(frameReports, perFrame);
+	}
+
+	EXPECT_EQ(h.Context->FramesLost, 0);
+	return bytes;
+}
+
+TEST(HybridReportsShrinkLightTouch)
+{
+	static const ULONG sizes[] = { 0, 1, 2, 5 };
+	static const int fingers[] = { 1, 2, 10 };
+	ULONG full[ARRAYSIZE(fingers)];
+
+	for (ULONG size : sizes) {
+		ULONG bytes[ARRAYSIZE(fingers)];
+
+		for (ULONG i = 0; i < ARRAYSIZE(fingers); i++) {
+			bytes[i] = ReportTestBytesPerSecond(size, fingers[i]);
+
+			if (size == 0)
+				full[i] = bytes[i];
+			else if (fingers[i] <= (int)size)
+				EXPECT_LT(bytes[i], full[i]);
+		}
+
+		REPORT("%2u contacts per report: %5u / %5u / %5u bytes/s for 1 / 2 / 10 fingers at 120 Hz",
+			size ? size : MULTI_MAX_COUNT, bytes[0], bytes[1], bytes[2]);
+	}
+}
+
+//
+// Bit offset in the touch input report of the field the descriptor gives
+// the Digitizers usage Usage, or -1 if it has none
+//
+static LONG ReportTestUsageOffset(const UCHAR* Descriptor, ULONG Length, UCHAR Usage)
+{
+	ULONG reportId = 0, reportSize = 0, reportCount = 0, usagePage = 0, bits = 0;
+	bool found = false;
+
+	for (ULONG offset = 0; offset < Length; offset += 1 + RaydItemSize(Descriptor[offset])) {
+		UCHAR tag = Descriptor[offset] & 0xfc;
+		ULONG value = RaydItemValue(&Descriptor[offset]);
+
+		if (tag == 0x04)
+			usagePage = value;
+		else if (tag == 0x08 && usagePage == 0x0d && value == Usage)
+			found = true;
+		else if (tag == HID_ITEM_REPORT_ID)
+			reportId = value;
+		else if (tag == HID_ITEM_REPORT_SIZE)
+			reportSize = value;
+		else if (tag == HID_ITEM_REPORT_COUNT)
+			reportCount = value;
+		else if (tag == HID_ITEM_INPUT && reportId == REPORTID_MTOUCH) {
+			if (found)
+				return (LONG)bits;
+			bits += reportSize * reportCount;
+		}
+
+		//
+		// Usages are local items, each main item uses them up
+		//
+		if ((tag & 0x0c) == 0)
+			found = false;
+	}
+
+	return -1;
+}
+
+TEST(ScanTimeFollowsTheInterrupts)
+{
+	const LONGLONG period = 4200 * SHIM_TICKS_PER_US;
+	RaydHarness h;
+	WDFREQUEST request;
+	std::vector<UCHAR> descriptor;
+	ULONG descriptorLength;
+	USHORT last = 0;
+	LONGLONG start;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+
+	//
+	// The report layout hidclass learns from the descriptor
+	//
+	request = h.Request(IOCTL_HID_GET_DEVICE_DESCRIPTOR, sizeof(HID_DESCRIPTOR));
+	descriptorLength = ((HID_DESCRIPTOR*)ShimRequestOutput(request))->DescriptorList[0].wReportLength;
+	ShimDeleteRequest(request);
+
+	request = h.Request(IOCTL_HID_GET_REPORT_DESCRIPTOR, descriptorLength);
+	EXPECT_EQ(ShimRequestStatus(request), STATUS_SUCCESS);
+	descriptor.assign(ShimRequestOutput(request), ShimRequestOutput(request) + descriptorLength);
+	ShimDeleteRequest(request);
+
+	EXPECT_EQ(RaydReportBits(descriptor.data(), descriptorLength, HID_ITEM_INPUT, REPORTID_MTOUCH),
+		(h.Context->ReportLength - 1) * 8);
+	EXPECT_EQ(ReportTestUsageOffset(descriptor.data(), descriptorLength, 0x56),
+		(FIELD_OFFSET(RaydMultiTouchReport, Touch) - 1 + h.Context->ContactsPerReport * sizeof(TOUCH)) * 8);
+	EXPECT_EQ(ReportTestUsageOffset(descriptor.data(), descriptorLength, 0x54), (h.Context->ReportLength - 2) * 8);
+
+	//
+	// Frames come in at a steady rate but take varying time on the bus.
+	// Scan time counts 100 us units from the interrupt, not the read.
+	//
+	start = ShimNow();
+	for (int i = 0; i < 200; i++) {
+		const UCHAR* report;
+		USHORT scanTime;
+
+		h.Bus.RequestLatencyUs = (i * 37) % 500;
+		ShimSleepUntil(start + i * period);
+
+		request = h.ReadReport();
+		EXPECT(h.Frame(HarnessContacts(1, i)));
+		EXPECT(ShimRequestCompleted(request));
+
+		report = ShimRequestOutput(request);
+		scanTime = (USHORT)(report[h.Context->ReportLength - 3] | (report[h.Context->ReportLength - 2] << 8));
+		if (i > 0)
+			EXPECT_EQ((USHORT)(scanTime - last), period / (100 * SHIM_TICKS_PER_US));
+
+		last = scanTime;
+		ShimDeleteRequest(request);
+	}
+}
+
+//
+// Ground truth finger traces, position in panel units at a time in seconds
+//
+typedef void (*REPORT_TEST_TRACE)(double Time, double* X, double* Y);
+
+static void ReportTestCircle(double Time, double* X, double* Y)
+{
+	*X = 683 + 200 * cos(2 * M_PI * Time);
+	*Y = 384 + 200 * sin(2 * M_PI * Time);
+}
+
+static void ReportTestFling(double Time, double* X, double* Y)
+{
+	//
+	// 2000 units/s to the right, slowing at 2500 units/s^2
+	//
+	Time = min(Time, 0.8);
+	*X = 200 + 2000 * Time - 1250 * Time * Time;
+	*Y = 400 + 100 * Time;
+}
+
+static void ReportTestSwipe(double Time, double* X, double* Y)
+{
+	*X = 200 + 900 * Time;
+	*Y = 600 - 400 * Time;
+}
+
+//
+// Replays a second of Trace at 120 Hz and measures how far the reported
+// positions are from where the finger is AheadMs later, the latency the
+// prediction is meant to hide
+//
+static void ReportTestReplay(ULONG PredictionMs, REPORT_TEST_TRACE Trace, ULONG AheadMs, double* Mean, double* Max)
+{
+	const LONGLONG period = SHIM_PERFORMANCE_FREQUENCY / 120;
+	RaydHarness h;
+	LONGLONG start;
+	double total = 0;
+	int samples = 0;
+
+	ShimSetRegistryULong(L"PredictionMs", PredictionMs);
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	EXPECT_EQ(h.Context->PredictionMs, PredictionMs);
+
+	*Max = 0;
+	start = ShimNow();
+
+	for (int i = 0; i < 120; i++) {
+		double time = (double)i / 120;
+		double x, y, truthX, truthY, error;
+		SIM_CONTACT contact = HarnessContact(0);
+		WDFREQUEST read;
+		const TOUCH* touch;
+
+		ShimSleepUntil(start + i * period);
+
+		Trace(time, &x, &y);
+		contact.X = (UINT16)lround(x);
+		contact.Y = (UINT16)lround(y);
+
+		read = h.ReadReport();
+		EXPECT(h.Frame({ contact }));
+		EXPECT(ShimRequestCompleted(read));
+		touch = (const TOUCH*)&ShimRequestOutput(read)[1];
+
+		//
+		// Prediction needs a few frames of history
+		//
+		if (i >= 3) {
+			Trace(time + AheadMs / 1000.0, &truthX, &truthY);
+			error = hypot(touch->XValue - truthX, touch->YValue - truthY);
+			total += error;
+			*Max = max(*Max, error);
+			samples++;
+		}
+
+		ShimDeleteRequest(read);
+	}
+
+	*Mean = total / samples;
+}
+
+TEST(PredictionReplay)
+{
+	static const struct {
+		const char* Name;
+		REPORT_TEST_TRACE Trace;
+	} traces[] = {
+		{ "circle", ReportTestCircle },
+		{ "fling", ReportTestFling },
+		{ "swipe", ReportTestSwipe },
+	};
+	static const ULONG predictions[] = { 0, 4, 8, 16 };
+	const ULONG aheadMs = 8;
+
+	for (const auto& trace : traces) {
+		double unpredicted = 0;
+
+		for (ULONG prediction : predictions) {
+			double mean, worst;
+
+			ReportTestReplay(prediction, trace.Trace, aheadMs, &mean, &worst);
+
+			if (prediction == 0)
+				unpredicted = mean;
+			else if (prediction == aheadMs)
+				EXPECT_LT(mean * 2, unpredicted);
+
+			REPORT("%-6s predicting %2u ms: mean error %5.1f, worst %5.1f against the position %u ms ahead",
+				trace.Name, prediction, mean, worst, aheadMs);
+		}
+	}
+}
+
+//
+// DefaultReportDescriptor with its zero LOGICAL_MAXIMUM placeholders
+// filled in, X and Y alternating, the way the descriptor used to be
+// patched by hand
+//
+static std::vector<UCHAR> ReportTestPatchedDefault(USHORT XMax, USHORT YMax)
+{
+	std::vector<UCHAR> descriptor(DefaultReportDescriptor, DefaultReportDescriptor + sizeof(DefaultReportDescriptor));
+	ULONG placeholders = 0;
+
+	for (ULONG offset = 0; offset < descriptor.size(); offset += 1 + RaydItemSize(descriptor[offset])) {
+		USHORT value = placeholders % 2 ? YMax : XMax;
+
+		if (descriptor[offset] != 0x26 || descriptor[offset + 1] != 0 || descriptor[offset + 2] != 0)
+			continue;
+
+		descriptor[offset + 1] = value & 0xFF;
+		descriptor[offset + 2] = value >> 8;
+		placeholders++;
+	}
+
+	EXPECT_EQ(placeholders, 2 * MULTI_MAX_COUNT);
+	return descriptor;
+}
+
+static ULONG ReportTestFirstDifference(const UCHAR* A, const UCHAR* B, ULONG Length)
+{
+	for (ULONG i = 0; i < Length; i++) {
+		if (A[i] != B[i])
+			return i;
+	}
+
+	return Length;
+}
+
+TEST(GeneratedDescriptorMatchesTheDefault)
+{
+	RAYD_DESCRIPTOR_LAYOUT layout = { MULTI_MAX_COUNT, RAYD_REPORT_USAGES, 0, 0, MULTI_MAX_COUNT };
+	std::vector<UCHAR> built(RaydWriteReportDescriptor(NULL, layout));
+
+	EXPECT_EQ(built.size(), sizeof(DefaultReportDescriptor));
+	EXPECT_EQ(RaydWriteReportDescriptor(built.data(), layout), built.size());
+	EXPECT_EQ(ReportTestFirstDifference(built.data(), DefaultReportDescriptor, sizeof(DefaultReportDescriptor)),
+		sizeof(DefaultReportDescriptor));
+
+	//
+	// The compile time instance is the same bytes
+	//
+	EXPECT_EQ(RaydFullReportDescriptor.Length, sizeof(DefaultReportDescriptor));
+	EXPECT(memcmp(RaydFullReportDescriptor.Bytes, DefaultReportDescriptor, sizeof(DefaultReportDescriptor)) == 0);
+}
+
+TEST(DeviceDescriptorMatchesThePatchedDefault)
+{
+	RaydHarness h;
+	std::vector<UCHAR> expected;
+	WDFREQUEST request;
+
+	EXPECT_EQ(h.Start(), STATUS_SUCCESS);
+	expected = ReportTestPatchedDefault(h.Panel.XMax, h.Panel.YMax);
+
+	request = h.Request(IOCTL_HID_GET_DEVICE_DESCRIPTOR, sizeof(HID_DESCRIPTOR));
+	EXPECT_EQ(((HID_DESCRIPTOR*)ShimRequestOutput(request))->DescriptorList[0].wReportLength, expected.size());
+	ShimDeleteRequest(request);
+
+	request = h.Request(IOCTL_HID_GET_REPORT_DESCRIPTOR, expected.size());
+	EXPECT_EQ(ShimRequestStatus(request), STATUS_SUCCESS);
+	EXPECT_EQ(ShimRequestInformation(request), expected.size());
+	EXPECT_EQ(ReportTestFirstDifference(ShimRequestOutput(request), expected.data(), (ULONG)expected.size()),
+		expected.size());
+	ShimDeleteRequest(request);
+}
+
+TEST(OptionalUsagesChangeTheLayout)
+{
+	RAYD_DESCRIPTOR_LAYOUT full = { MULTI_MAX_COUNT, RAYD_REPORT_USAGES, 1366, 768, MULTI_MAX_COUNT };
+	RAYD_DESCRIPTOR_LAYOUT pressure = full;
+	RAYD_DESCRIPTOR_LAYOUT bare = full;
+	std::vector<UCHAR> descriptor;
+
+	pressure.Usages |= RAYD_USAGE_PRESSURE;
+	bare.Usages = 0;
+
+	//
+	// Width, height and pressure each add a field per contact, sized like
+	// X and Y before them, and scan time a 16 bit field per report
+	//
+	descriptor.resize(RaydWriteReportDescriptor(NULL, pressure));
+	RaydWriteReportDescriptor(descriptor.data(), pressure);
+	EXPECT_EQ(descriptor.size(), sizeof(DefaultReportDescriptor) + MULTI_MAX_COUNT * sizeof(RaydTouchPressure));
+	EXPECT_EQ(RaydReportBits(descriptor.data(), (ULONG)descriptor.size(), HID_ITEM_INPUT, REPORTID_MTOUCH),
+		(sizeof(RaydMultiTouchReport) - 1 + MULTI_MAX_COUNT * sizeof(USHORT)) * 8);
+
+	descriptor.resize(RaydWriteReportDescriptor(NULL, bare));
+	RaydWriteReportDescriptor(descriptor.data(), bare);
+	EXPECT_EQ(RaydReportBits(descriptor.data(), (ULONG)descriptor.size(), HID_ITEM_INPUT, REPORTID_MTOUCH),
+		(sizeof(RaydMultiTouchReport) - 1 - MULTI_MAX_COUNT * 2 * sizeof(USHORT) - sizeof(USHORT)) * 8);
+	EXPECT_EQ(ReportTestUsageOffset(descriptor.data(), (ULONG)descriptor.size(), 0x56), -1);
+}
@@ -0,0 +1,276 @@
+/*++
+
+Module Name:
+
+spb_test.cpp
+
+Abstract:
+
+Tests for the SPB transport helpers in spb.cpp against the fake SPB
+controller: what reaches the bus for each helper, fault propagation
+and transport buffer reuse.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <vector>
+
+#include "host_test.h"
+#include "wdf_shim.h"
+#include "fake_spb.h"
+
+#include "../spb.h"
+
+//
+// Remembers what was written and reads back an incrementing pattern
+//
+class LoopbackDevice : public FakeI2cDevice
+{
+public:
+	std::vector<UINT8> Written;
+	UINT8 Next = 0;
+
+	bool Write(const UINT8* Data, ULONG Length) override
+	{
+		Written.insert(Written.end(), Data, Data + Length);
+		return true;
+	}
+
+	bool Read(UINT8* Data, ULONG Length) override
+	{
+		for (ULONG i = 0; i < Length; i++)
+			Data[i] = Next++;
+		return true;
+	}
+};
+
+class SpbFixture
+{
+public:
+	FakeSpbTarget Bus;
+	LoopbackDevice Peripheral;
+	SPB_CONTEXT Spb = {};
+	WDFDEVICE Device = NULL;
+
+	SpbFixture()
+	{
+		PWDFDEVICE_INIT init = ShimCreateDeviceInit();
+		WDF_OBJECT_ATTRIBUTES attributes;
+
+		Bus.Device = &Peripheral;
+		ShimSetSpbTarget(&Bus);
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		WdfDeviceCreate(&init, &attributes, &Device);
+
+		Spb.I2cResHubId.LowPart = 1;
+		EXPECT_EQ(SpbTargetInitialize(Device, &Spb), STATUS_SUCCESS);
+	}
+
+	~SpbFixture()
+	{
+		SpbTargetDeinitialize(Device, &Spb);
+	}
+};
+
+TEST(SequenceIsOneBusTransaction)
+{
+	SpbFixture f;
+	UINT8 prefix[5] = { 0xAA, 0x20, 0x00, 0x08, 0x00 };
+	UINT8 reg = 0x10;
+	UINT8 data[8];
+
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, prefix, sizeof(prefix), &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+
+	EXPECT_EQ(f.Bus.Log.size(), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbSequence), 1);
+	EXPECT_EQ(f.Bus.Log[0].Written.size(), sizeof(prefix) + 1);
+	EXPECT_EQ(f.Bus.Log[0].BytesRead, sizeof(data));
+	EXPECT_EQ(data[0], 0);
+	EXPECT_EQ(data[7], 7);
+	EXPECT(!f.Spb.SequenceUnsupported);
+}
+
+TEST(SequenceFallsBackToSeparateTransfers)
+{
+	SpbFixture f;
+	UINT8 prefix[5] = { 0xAA, 0x20, 0x00, 0x08, 0x00 };
+	UINT8 reg = 0x10;
+	UINT8 data[8];
+
+	f.Bus.SequenceSupported = false;
+
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, prefix, sizeof(prefix), &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+	EXPECT(f.Spb.SequenceUnsupported);
+	EXPECT_EQ(f.Bus.Count(FakeSpbSequence), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbWrite), 2);
+	EXPECT_EQ(f.Bus.Count(FakeSpbRead), 1);
+
+	//
+	// The rejection is remembered, later reads don't try again
+	//
+	f.Bus.ClearLog();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+	EXPECT_EQ(f.Bus.Count(FakeSpbSequence), 0);
+	EXPECT_EQ(f.Bus.Count(FakeSpbWrite), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbRead), 1);
+	EXPECT_EQ(f.Peripheral.Written.size(), sizeof(prefix) + 2);
+}
+
+TEST(NackFailsTheTransfer)
+{
+	SpbFixture f;
+	UINT8 reg = 0x10;
+	UINT8 data[4];
+
+	f.Bus.NackNext();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), FAKE_SPB_NACK_STATUS);
+	EXPECT(!f.Spb.SequenceUnsupported);
+
+	f.Bus.NackNext();
+	EXPECT_EQ(SpbWriteRegisterSynchronously(&f.Spb, 0x04, data, 1), FAKE_SPB_NACK_STATUS);
+
+	EXPECT_EQ(SpbWriteRegisterSynchronously(&f.Spb, 0x04, data, 1), STATUS_SUCCESS);
+}
+
+TEST(ShortReadIsAProtocolError)
+{
+	SpbFixture f;
+	UINT8 reg = 0x10;
+	UINT8 data[16];
+
+	f.Bus.ShortReadNext(8);
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_DEVICE_PROTOCOL_ERROR);
+
+	//
+	// The separate read of the fallback path checks its length too
+	//
+	f.Bus.ShortReadNext(8);
+	EXPECT_EQ(SpbXferDataSynchronously(&f.Spb, &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+	f.Bus.ShortReadNext(8, 2);
+	EXPECT_EQ(SpbXferDataSynchronously(&f.Spb, &reg, 1, data, sizeof(data)), STATUS_DEVICE_PROTOCOL_ERROR);
+}
+
+TEST(TransfersReuseTheTransportBuffers)
+{
+	SpbFixture f;
+	UINT8 reg = 0x10;
+	UINT8 data[160];
+	ULONG memory;
+
+	EXPECT_EQ(f.Spb.BufferSize, DEFAULT_SPB_BUFFER_SIZE);
+	EXPECT_EQ(f.Spb.BufferAllocations, 2);
+
+	f.Bus.SequenceSupported = false;
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_INVALID_BUFFER_SIZE);
+
+	EXPECT_EQ(SpbTargetReserveBuffers(&f.Spb, sizeof(data)), STATUS_SUCCESS);
+	EXPECT_EQ(SpbTargetReserveBuffers(&f.Spb, DEFAULT_SPB_BUFFER_SIZE), STATUS_SUCCESS);
+	EXPECT_EQ(f.Spb.BufferSize, sizeof(data));
+	EXPECT_EQ(f.Spb.BufferAllocations, 4);
+
+	memory = ShimMemoryAllocations();
+
+	for (int i = 0; i < 100; i++) {
+		EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+		EXPECT_EQ(SpbWriteRegisterSynchronously(&f.Spb, 0x04, data, 4), STATUS_SUCCESS);
+	}
+
+	EXPECT_EQ(ShimMemoryAllocations(), memory);
+	EXPECT_EQ(f.Spb.BufferAllocations, 4);
+}
+
+TEST(TransferTimeFollowsBusSpeed)
+{
+	SpbFixture f;
+	UINT8 reg = 0x10;
+	UINT8 data[56];
+	LONGLONG start;
+
+	f.Bus.RequestLatencyUs = 30;
+	f.Bus.ByteTimeNs = 22500;
+
+	start = ShimNow();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+
+	//
+	// Two address bytes, the register and the data
+	//
+	EXPECT_EQ(ShimNow() - start, 30 * SHIM_TICKS_PER_US + (2 + 1 + 56) * 22500 * SHIM_TICKS_PER_US / 1000);
+	EXPECT_EQ(f.Bus.BusTime(), ShimNow() - start);
+	REPORT("56 byte read: %lld us", (ShimNow() - start) / SHIM_TICKS_PER_US);
+}
+
+TEST(ControllerLockBracketsTransfers)
+{
+	SpbFixture f;
+	UINT8 data[4] = {};
+
+	EXPECT_EQ(SpbLockController(&f.Spb), STATUS_SUCCESS);
+	EXPECT(f.Bus.ControllerLocked());
+	EXPECT_EQ(SpbWriteRegisterSynchronously(&f.Spb, 0x04, data, 1), STATUS_SUCCESS);
+	EXPECT_EQ(SpbXferDataSynchronously(&f.Spb, data, 1, data, sizeof(data)), STATUS_SUCCESS);
+	EXPECT_EQ(SpbUnlockController(&f.Spb), STATUS_SUCCESS);
+	EXPECT(!f.Bus.ControllerLocked());
+
+	EXPECT_EQ(f.Bus.Count(FakeSpbLock), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbUnlock), 1);
+	for (const FAKE_SPB_TRANSACTION& t : f.Bus.Log) {
+		if (t.Op == FakeSpbWrite || t.Op == FakeSpbRead)
+			EXPECT(t.ControllerLocked);
+	}
+
+	EXPECT_EQ(SpbUnlockController(&f.Spb), STATUS_INVALID_DEVICE_REQUEST);
+}
+
+TEST(SequenceUnderControllerLockIsNotLatched)
+{
+	SpbFixture f;
+	UINT8 reg = 0x10;
+	UINT8 data[4];
+
+	//
+	// SpbCx turns a sequence from a client holding the controller lock
+	// away. That says nothing about the controller's sequence support.
+	//
+	EXPECT_EQ(SpbLockController(&f.Spb), STATUS_SUCCESS);
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_INVALID_DEVICE_REQUEST);
+	EXPECT_EQ(SpbUnlockController(&f.Spb), STATUS_SUCCESS);
+	EXPECT(!f.Spb.SequenceUnsupported);
+
+	f.Bus.ClearLog();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, NULL, 0, &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+	EXPECT_EQ(f.Bus.Log.size(), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbSequence), 1);
+}
+
+TEST(SequenceFallbackLocksTheController)
+{
+	SpbFixture f;
+	UINT8 prefix[5] = { 0xAA, 0x20, 0x00, 0x08, 0x00 };
+	UINT8 reg = 0x10;
+	UINT8 data[8];
+
+	f.Bus.SequenceSupported = false;
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, prefix, sizeof(prefix), &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+
+	f.Bus.ClearLog();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, prefix, sizeof(prefix), &reg, 1, data, sizeof(data)), STATUS_SUCCESS);
+	EXPECT_EQ(f.Bus.Count(FakeSpbLock), 1);
+	EXPECT_EQ(f.Bus.Count(FakeSpbUnlock), 1);
+	EXPECT_EQ(f.Bus.DataTransfers(), 3);
+	for (const FAKE_SPB_TRANSACTION& t : f.Bus.Log) {
+		if (t.Op == FakeSpbWrite || t.Op == FakeSpbRead)
+			EXPECT(t.ControllerLocked);
+	}
+
+	//
+	// A failed transfer still releases the controller
+	//
+	f.Bus.NackNext();
+	EXPECT_EQ(SpbXferSequenceSynchronously(&f.Spb, prefix, sizeof(prefix), &reg, 1, data, sizeof(data)), FAKE_SPB_NACK_STATUS);
+	EXPECT(!f.Bus.ControllerLocked());
+}
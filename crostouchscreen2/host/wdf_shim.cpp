@@ -0,0 +1,1304 @@
+/*++
+
+Module Name:
+
+wdf_shim.cpp
+
+Abstract:
+
+Host implementation of the WDF and WDM routines the driver calls. The
+framework objects are plain C++ objects, I/O targets forward to the
+fake SPB controller, and every wait runs on the virtual clock of a
+cooperative scheduler so tests are deterministic and cost no wall time.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wdf_shim.h"
+#include "fake_spb.h"
+
+#include <reshub.h>
+
+#define SHIM_INFINITE	INT64_MAX
+
+//
+// Clock origin. Zero timestamps mean "not stamped" to the driver.
+//
+#define SHIM_CLOCK_START	(1000 * SHIM_TICKS_PER_MS)
+
+static void ShimFatal(const char* Format, ...)
+{
+	va_list args;
+
+	va_start(args, Format);
+	fprintf(stderr, "shim: ");
+	vfprintf(stderr, Format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+
+	abort();
+}
+
+//
+// Scheduler
+//
+
+struct ShimThread {
+	std::condition_variable Cv;
+	std::thread Thread;
+	std::function<void()> Routine;
+	LONGLONG WakeTime = 0;
+	const void* WaitObject = nullptr;
+	ULONGLONG Sequence = 0;
+	bool Signaled = false;
+	bool Done = false;
+};
+
+static std::mutex g_SchedulerLock;
+static std::vector<std::unique_ptr<ShimThread>> g_Threads;
+static ShimThread* g_Current;
+static thread_local ShimThread* t_Self;
+static LONGLONG g_Now = SHIM_CLOCK_START;
+static ULONGLONG g_Sequence;
+static char g_JoinObject;
+
+static ShimThread* ShimPickThread()
+{
+	ShimThread* next = nullptr;
+
+	for (auto& thread : g_Threads) {
+		if (thread->Done || thread->WakeTime == SHIM_INFINITE)
+			continue;
+
+		if (!next || thread->WakeTime < next->WakeTime ||
+			(thread->WakeTime == next->WakeTime && thread->Sequence < next->Sequence))
+			next = thread.get();
+	}
+
+	return next;
+}
+
+//
+// Hands the CPU to the thread due first, which may be the caller, and
+// returns once the caller is picked again. The caller has set up its
+// wake time and wait object already.
+//
+static void ShimSwitch(std::unique_lock<std::mutex>& Lock)
+{
+	ShimThread* self = t_Self;
+	ShimThread* next = ShimPickThread();
+
+	if (!next)
+		ShimFatal("deadlock, every simulated thread waits without a timeout");
+
+	if (next->WakeTime > g_Now)
+		g_Now = next->WakeTime;
+
+	g_Current = next;
+	if (next != self)
+		next->Cv.notify_one();
+
+	if (self->Done)
+		return;
+
+	self->Cv.wait(Lock, [self] { return g_Current == self; });
+}
+
+//
+// Blocks the calling thread until Deadline, or until another thread
+// wakes it through Object. Returns true when woken.
+//
+static bool ShimBlock(const void* Object, LONGLONG Deadline)
+{
+	std::unique_lock<std::mutex> lock(g_SchedulerLock);
+	ShimThread* self = t_Self;
+
+	if (!self)
+		ShimFatal("wait from a thread the shim does not know, call ShimReset first");
+
+	self->WaitObject = Object;
+	self->WakeTime = Deadline;
+	self->Signaled = false;
+	self->Sequence = ++g_Sequence;
+
+	ShimSwitch(lock);
+
+	self->WaitObject = nullptr;
+	return self->Signaled;
+}
+
+static void ShimWakeThread(ShimThread* Thread)
+{
+	Thread->WaitObject = nullptr;
+	Thread->Signaled = true;
+	Thread->WakeTime = g_Now;
+	Thread->Sequence = ++g_Sequence;
+}
+
+//
+// Wakes the threads blocked on Object in the order they blocked, at most
+// Count of them. Returns the number woken.
+//
+static ULONG ShimWake(const void* Object, ULONG Count)
+{
+	std::vector<ShimThread*> waiters;
+
+	for (auto& thread : g_Threads) {
+		if (!thread->Done && thread->WaitObject == Object)
+			waiters.push_back(thread.get());
+	}
+
+	std::sort(waiters.begin(), waiters.end(), [](ShimThread* a, ShimThread* b) {
+		return a->Sequence < b->Sequence;
+	});
+
+	ULONG woken = 0;
+	for (ShimThread* thread : waiters) {
+		if (woken == Count)
+			break;
+		ShimWakeThread(thread);
+		woken++;
+	}
+
+	return woken;
+}
+
+static LONGLONG ShimDeadline(const LONGLONG* Timeout)
+{
+	if (!Timeout)
+		return SHIM_INFINITE;
+
+	//
+	// Negative timeouts are relative, positive ones absolute
+	//
+	return *Timeout < 0 ? g_Now - *Timeout : *Timeout;
+}
+
+LONGLONG ShimNow()
+{
+	return g_Now;
+}
+
+VOID ShimSleep(LONGLONG Ticks)
+{
+	ShimBlock(nullptr, g_Now + max(Ticks, 0LL));
+}
+
+VOID ShimSleepUntil(LONGLONG Time)
+{
+	ShimBlock(nullptr, max(Time, g_Now));
+}
+
+VOID ShimStartThread(std::function<void()> Routine)
+{
+	std::unique_lock<std::mutex> lock(g_SchedulerLock);
+	std::unique_ptr<ShimThread> owned(new ShimThread);
+	ShimThread* thread = owned.get();
+
+	thread->Routine = std::move(Routine);
+	thread->WakeTime = g_Now;
+	thread->Sequence = ++g_Sequence;
+	g_Threads.push_back(std::move(owned));
+
+	thread->Thread = std::thread([thread] {
+		std::unique_lock<std::mutex> lock(g_SchedulerLock);
+
+		t_Self = thread;
+		thread->Cv.wait(lock, [thread] { return g_Current == thread; });
+		lock.unlock();
+
+		thread->Routine();
+
+		lock.lock();
+		thread->Done = true;
+		ShimWake(&g_JoinObject, MAXULONG);
+		ShimSwitch(lock);
+	});
+}
+
+VOID ShimJoinThreads()
+{
+	for (;;) {
+		bool running = false;
+
+		for (auto& thread : g_Threads) {
+			if (thread.get() != t_Self && !thread->Done)
+				running = true;
+		}
+
+		if (!running)
+			break;
+
+		ShimBlock(&g_JoinObject, SHIM_INFINITE);
+	}
+
+	//
+	// The threads are done, reap them
+	//
+	for (auto& thread : g_Threads) {
+		if (thread->Thread.joinable())
+			thread->Thread.join();
+	}
+
+	std::unique_lock<std::mutex> lock(g_SchedulerLock);
+	g_Threads.erase(std::remove_if(g_Threads.begin(), g_Threads.end(),
+		[](const std::unique_ptr<ShimThread>& thread) { return thread.get() != t_Self; }),
+		g_Threads.end());
+}
+
+//
+// Framework objects
+//
+
+struct ShimObject {
+	PVOID Context = nullptr;
+
+	virtual ~ShimObject()
+	{
+		free(Context);
+	}
+};
+
+static std::set<ShimObject*> g_Objects;
+
+template <typename T>
+static T* ShimCreate(PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+	T* object = new T;
+
+	if (Attributes && Attributes->ContextSize) {
+		object->Context = calloc(1, Attributes->ContextSize);
+		if (!object->Context)
+			ShimFatal("out of memory");
+	}
+
+	g_Objects.insert(object);
+	return object;
+}
+
+template <typename T>
+static T* ShimGet(const void* Handle)
+{
+	ShimObject* object = (ShimObject*)Handle;
+
+	if (!object || !g_Objects.count(object))
+		ShimFatal("invalid or deleted handle %p", Handle);
+
+	T* typed = dynamic_cast<T*>(object);
+	if (!typed)
+		ShimFatal("handle %p has the wrong type", Handle);
+
+	return typed;
+}
+
+PVOID ShimObjectGetContext(WDFOBJECT Handle)
+{
+	return ShimGet<ShimObject>(Handle)->Context;
+}
+
+VOID WdfObjectDelete(WDFOBJECT Object)
+{
+	ShimObject* object = ShimGet<ShimObject>(Object);
+
+	g_Objects.erase(object);
+	delete object;
+}
+
+struct ShimMemory : ShimObject {
+	std::vector<UCHAR> Owned;
+	PUCHAR Buffer = nullptr;
+	size_t Size = 0;
+};
+
+struct ShimWaitLock : ShimObject {
+	ShimThread* Owner = nullptr;
+	std::deque<ShimThread*> Waiters;
+	LONGLONG AcquiredAt = 0;
+	SHIM_LOCK_STATS Stats = {};
+};
+
+struct ShimSpinLock : ShimObject {
+	bool Held = false;
+};
+
+struct ShimQueue;
+
+struct ShimDevice : ShimObject {
+	WDF_PNPPOWER_EVENT_CALLBACKS Callbacks = {};
+	ShimQueue* DefaultQueue = nullptr;
+	WDF_DEVICE_FAILED_ACTION FailedAction = WdfDeviceFailedUndefined;
+};
+
+struct ShimQueue : ShimObject {
+	ShimDevice* Device = nullptr;
+	WDF_IO_QUEUE_DISPATCH_TYPE DispatchType = WdfIoQueueDispatchInvalid;
+	PFN_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL EvtIoInternalDeviceControl = nullptr;
+	std::deque<WDFREQUEST> Requests;
+};
+
+struct ShimRequest : ShimObject {
+	ULONG IoControlCode = 0;
+	std::vector<UCHAR> Output;
+	std::vector<UCHAR> Input;
+	IRP Irp = {};
+	WDFMEMORY OutputMemory = nullptr;
+	bool Completed = false;
+	NTSTATUS Status = STATUS_SUCCESS;
+	ULONG_PTR Information = 0;
+
+	~ShimRequest()
+	{
+		if (OutputMemory)
+			WdfObjectDelete(OutputMemory);
+	}
+};
+
+struct ShimIoTarget : ShimObject {
+	FakeSpbTarget* Target = nullptr;
+};
+
+struct ShimKey : ShimObject {
+};
+
+struct ShimResourceList : ShimObject {
+	std::vector<CM_PARTIAL_RESOURCE_DESCRIPTOR> Descriptors;
+};
+
+struct ShimInterrupt : ShimObject {
+	ShimDevice* Device = nullptr;
+	PFN_WDF_INTERRUPT_ISR Isr = nullptr;
+	PFN_WDF_INTERRUPT_WORKITEM WorkItem = nullptr;
+	bool WorkItemQueued = false;
+	bool DeferWorkItem = false;
+};
+
+struct ShimWorkItem : ShimObject {
+	PFN_WDF_WORKITEM Routine = nullptr;
+};
+
+struct WDFDEVICE_INIT {
+	WDF_PNPPOWER_EVENT_CALLBACKS Callbacks;
+	WDFDEVICE Device;
+};
+
+//
+// Environment and counters
+//
+
+static FakeSpbTarget* g_SpbTarget;
+static std::map<std::wstring, ULONG> g_Registry;
+static std::vector<std::unique_ptr<WDFDEVICE_INIT>> g_DeviceInits;
+static std::set<PVOID> g_Pool;
+static ULONG g_PoolAllocations;
+static ULONG g_MemoryAllocations;
+static ULONGLONG g_BytesCopied;
+
+VOID ShimReset()
+{
+	for (auto& thread : g_Threads) {
+		if (thread.get() != t_Self && !thread->Done)
+			ShimFatal("ShimReset with simulated threads still running");
+	}
+
+	ShimJoinThreads();
+
+	//
+	// Requests first, they own memory objects of their own
+	//
+	std::vector<ShimObject*> requests;
+	for (ShimObject* object : g_Objects) {
+		if (dynamic_cast<ShimRequest*>(object))
+			requests.push_back(object);
+	}
+
+	for (ShimObject* object : requests)
+		WdfObjectDelete(object);
+
+	for (ShimObject* object : g_Objects)
+		delete object;
+	g_Objects.clear();
+
+	for (PVOID p : g_Pool)
+		free(p);
+	g_Pool.clear();
+
+	g_SpbTarget = nullptr;
+	g_Registry.clear();
+	g_DeviceInits.clear();
+	g_PoolAllocations = 0;
+	g_MemoryAllocations = 0;
+	g_BytesCopied = 0;
+
+	std::unique_lock<std::mutex> lock(g_SchedulerLock);
+
+	g_Threads.clear();
+	g_Threads.push_back(std::unique_ptr<ShimThread>(new ShimThread));
+	t_Self = g_Threads.back().get();
+	g_Current = t_Self;
+	g_Now = SHIM_CLOCK_START;
+	g_Sequence = 0;
+}
+
+VOID ShimSetSpbTarget(FakeSpbTarget* Target)
+{
+	g_SpbTarget = Target;
+}
+
+VOID ShimSetRegistryULong(PCWSTR Name, ULONG Value)
+{
+	g_Registry[Name] = Value;
+}
+
+ULONG ShimPoolAllocations()
+{
+	return g_PoolAllocations;
+}
+
+ULONG ShimMemoryAllocations()
+{
+	return g_MemoryAllocations;
+}
+
+ULONGLONG ShimBytesCopied()
+{
+	return g_BytesCopied;
+}
+
+VOID ShimCopyMemory(PVOID Destination, const VOID* Source, SIZE_T Length)
+{
+	memmove(Destination, Source, Length);
+	g_BytesCopied += Length;
+}
+
+LONG ShimOutstandingPool()
+{
+	return (LONG)g_Pool.size();
+}
+
+//
+// Kernel routines
+//
+
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString)
+{
+	size_t length = SourceString ? wcslen(SourceString) * sizeof(WCHAR) : 0;
+
+	DestinationString->Length = (USHORT)length;
+	DestinationString->MaximumLength = (USHORT)(SourceString ? length + sizeof(WCHAR) : 0);
+	DestinationString->Buffer = (PWCH)SourceString;
+}
+
+VOID RtlInitEmptyUnicodeString(PUNICODE_STRING DestinationString, PWCH Buffer, USHORT BufferSize)
+{
+	DestinationString->Length = 0;
+	DestinationString->MaximumLength = BufferSize;
+	DestinationString->Buffer = Buffer;
+}
+
+ULONG RtlRandomEx(PULONG Seed)
+{
+	*Seed = (ULONG)(((ULONGLONG)*Seed * 0x7fffffed + 0x7fffffc3) % MAXLONG);
+	return *Seed;
+}
+
+ULONG DbgPrint(PCSTR Format, ...)
+{
+	UNREFERENCED_PARAMETER(Format);
+	return 0;
+}
+
+PVOID ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag)
+{
+	UNREFERENCED_PARAMETER(Flags);
+	UNREFERENCED_PARAMETER(Tag);
+
+	PVOID p = calloc(1, max(NumberOfBytes, (SIZE_T)1));
+	if (p) {
+		g_Pool.insert(p);
+		g_PoolAllocations++;
+	}
+
+	return p;
+}
+
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+	UNREFERENCED_PARAMETER(Tag);
+
+	if (!g_Pool.erase(P))
+		ShimFatal("freeing pool %p that was not allocated", P);
+
+	free(P);
+}
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+	Event->Signaled = State ? 1 : 0;
+	Event->Type = Type;
+}
+
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+	UNREFERENCED_PARAMETER(Increment);
+	UNREFERENCED_PARAMETER(Wait);
+
+	LONG previous = Event->Signaled;
+
+	std::unique_lock<std::mutex> lock(g_SchedulerLock);
+
+	if (Event->Type == SynchronizationEvent) {
+		if (ShimWake(Event, 1) == 0)
+			Event->Signaled = 1;
+	}
+	else {
+		Event->Signaled = 1;
+		ShimWake(Event, MAXULONG);
+	}
+
+	return previous;
+}
+
+VOID KeClearEvent(PRKEVENT Event)
+{
+	Event->Signaled = 0;
+}
+
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+	UNREFERENCED_PARAMETER(WaitReason);
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	PKEVENT event = (PKEVENT)Object;
+
+	if (event->Signaled) {
+		if (event->Type == SynchronizationEvent)
+			event->Signaled = 0;
+		return STATUS_SUCCESS;
+	}
+
+	if (Timeout && Timeout->QuadPart == 0)
+		return STATUS_TIMEOUT;
+
+	return ShimBlock(event, ShimDeadline(Timeout ? &Timeout->QuadPart : NULL)) ?
+		STATUS_SUCCESS : STATUS_TIMEOUT;
+}
+
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval)
+{
+	UNREFERENCED_PARAMETER(WaitMode);
+	UNREFERENCED_PARAMETER(Alertable);
+
+	ShimSleepUntil(ShimDeadline(&Interval->QuadPart));
+	return STATUS_SUCCESS;
+}
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency)
+{
+	LARGE_INTEGER now;
+
+	if (PerformanceFrequency)
+		PerformanceFrequency->QuadPart = SHIM_PERFORMANCE_FREQUENCY;
+
+	now.QuadPart = g_Now;
+	return now;
+}
+
+ULONGLONG KeQueryInterruptTime(VOID)
+{
+	return (ULONGLONG)g_Now;
+}
+
+NTSTATUS RESOURCE_HUB_CREATE_PATH_FROM_ID(PUNICODE_STRING DevicePath, ULONG IdLowPart, ULONG IdHighPart)
+{
+	int length = swprintf(DevicePath->Buffer, DevicePath->MaximumLength / sizeof(WCHAR),
+		L"\\Device\\RESOURCE_HUB\\%08x%08x", IdHighPart, IdLowPart);
+
+	if (length < 0)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	DevicePath->Length = (USHORT)(length * sizeof(WCHAR));
+	return STATUS_SUCCESS;
+}
+
+//
+// Driver and device
+//
+
+NTSTATUS WdfDriverCreate(PDRIVER_OBJECT DriverObject, PCUNICODE_STRING RegistryPath, PWDF_OBJECT_ATTRIBUTES DriverAttributes, PWDF_DRIVER_CONFIG DriverConfig, WDFDRIVER* Driver)
+{
+	UNREFERENCED_PARAMETER(DriverObject);
+	UNREFERENCED_PARAMETER(RegistryPath);
+	UNREFERENCED_PARAMETER(DriverAttributes);
+	UNREFERENCED_PARAMETER(DriverConfig);
+
+	if (Driver)
+		*Driver = NULL;
+
+	return STATUS_SUCCESS;
+}
+
+PWDFDEVICE_INIT ShimCreateDeviceInit()
+{
+	g_DeviceInits.push_back(std::unique_ptr<WDFDEVICE_INIT>(new WDFDEVICE_INIT()));
+	return g_DeviceInits.back().get();
+}
+
+WDFDEVICE ShimDeviceInitGetDevice(PWDFDEVICE_INIT DeviceInit)
+{
+	return DeviceInit->Device;
+}
+
+VOID WdfFdoInitSetFilter(PWDFDEVICE_INIT DeviceInit)
+{
+	UNREFERENCED_PARAMETER(DeviceInit);
+}
+
+VOID WdfDeviceInitSetPnpPowerEventCallbacks(PWDFDEVICE_INIT DeviceInit, PWDF_PNPPOWER_EVENT_CALLBACKS PnpPowerEventCallbacks)
+{
+	DeviceInit->Callbacks = *PnpPowerEventCallbacks;
+}
+
+NTSTATUS WdfDeviceCreate(PWDFDEVICE_INIT* DeviceInit, PWDF_OBJECT_ATTRIBUTES DeviceAttributes, WDFDEVICE* Device)
+{
+	ShimDevice* device = ShimCreate<ShimDevice>(DeviceAttributes);
+
+	device->Callbacks = (*DeviceInit)->Callbacks;
+	(*DeviceInit)->Device = (WDFDEVICE)(ShimObject*)device;
+
+	//
+	// The framework owns the init structure from here on
+	//
+	*Device = (*DeviceInit)->Device;
+	*DeviceInit = NULL;
+
+	return STATUS_SUCCESS;
+}
+
+VOID WdfDeviceSetFailed(WDFDEVICE Device, WDF_DEVICE_FAILED_ACTION FailedAction)
+{
+	ShimGet<ShimDevice>(Device)->FailedAction = FailedAction;
+}
+
+WDF_DEVICE_FAILED_ACTION ShimDeviceFailedAction(WDFDEVICE Device)
+{
+	return ShimGet<ShimDevice>(Device)->FailedAction;
+}
+
+WDFQUEUE ShimDeviceDefaultQueue(WDFDEVICE Device)
+{
+	return (WDFQUEUE)(ShimObject*)ShimGet<ShimDevice>(Device)->DefaultQueue;
+}
+
+//
+// Registry. Every key sees the same set of values.
+//
+
+NTSTATUS WdfDeviceOpenRegistryKey(WDFDEVICE Device, ULONG DeviceInstanceKeyType, ACCESS_MASK DesiredAccess, PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key)
+{
+	UNREFERENCED_PARAMETER(DeviceInstanceKeyType);
+	UNREFERENCED_PARAMETER(DesiredAccess);
+
+	ShimGet<ShimDevice>(Device);
+	*Key = (WDFKEY)(ShimObject*)ShimCreate<ShimKey>(KeyAttributes);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryOpenKey(WDFKEY ParentKey, PCUNICODE_STRING KeyName, ACCESS_MASK DesiredAccess, PWDF_OBJECT_ATTRIBUTES KeyAttributes, WDFKEY* Key)
+{
+	UNREFERENCED_PARAMETER(KeyName);
+	UNREFERENCED_PARAMETER(DesiredAccess);
+
+	ShimGet<ShimKey>(ParentKey);
+	*Key = (WDFKEY)(ShimObject*)ShimCreate<ShimKey>(KeyAttributes);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRegistryQueryULong(WDFKEY Key, PCUNICODE_STRING ValueName, PULONG Value)
+{
+	ShimGet<ShimKey>(Key);
+
+	auto it = g_Registry.find(std::wstring(ValueName->Buffer, ValueName->Length / sizeof(WCHAR)));
+	if (it == g_Registry.end())
+		return STATUS_NOT_FOUND;
+
+	*Value = it->second;
+	return STATUS_SUCCESS;
+}
+
+VOID WdfRegistryClose(WDFKEY Key)
+{
+	WdfObjectDelete(Key);
+}
+
+//
+// Resources
+//
+
+WDFCMRESLIST ShimCreateI2cResourceList(ULONG IdLowPart, ULONG IdHighPart)
+{
+	ShimResourceList* list = ShimCreate<ShimResourceList>(NULL);
+	CM_PARTIAL_RESOURCE_DESCRIPTOR descriptor = {};
+
+	descriptor.Type = CmResourceTypeConnection;
+	descriptor.u.Connection.Class = CM_RESOURCE_CONNECTION_CLASS_SERIAL;
+	descriptor.u.Connection.Type = CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C;
+	descriptor.u.Connection.IdLowPart = IdLowPart;
+	descriptor.u.Connection.IdHighPart = IdHighPart;
+	list->Descriptors.push_back(descriptor);
+
+	return (WDFCMRESLIST)(ShimObject*)list;
+}
+
+ULONG WdfCmResourceListGetCount(WDFCMRESLIST List)
+{
+	return (ULONG)ShimGet<ShimResourceList>(List)->Descriptors.size();
+}
+
+PCM_PARTIAL_RESOURCE_DESCRIPTOR WdfCmResourceListGetDescriptor(WDFCMRESLIST List, ULONG Index)
+{
+	ShimResourceList* list = ShimGet<ShimResourceList>(List);
+
+	return Index < list->Descriptors.size() ? &list->Descriptors[Index] : NULL;
+}
+
+//
+// Memory
+//
+
+NTSTATUS WdfMemoryCreate(PWDF_OBJECT_ATTRIBUTES Attributes, POOL_TYPE PoolType, ULONG PoolTag, size_t BufferSize, WDFMEMORY* Memory, PVOID* Buffer)
+{
+	UNREFERENCED_PARAMETER(PoolType);
+	UNREFERENCED_PARAMETER(PoolTag);
+
+	ShimMemory* memory = ShimCreate<ShimMemory>(Attributes);
+
+	memory->Owned.resize(BufferSize);
+	memory->Buffer = memory->Owned.data();
+	memory->Size = BufferSize;
+	g_MemoryAllocations++;
+
+	*Memory = (WDFMEMORY)(ShimObject*)memory;
+	if (Buffer)
+		*Buffer = memory->Buffer;
+
+	return STATUS_SUCCESS;
+}
+
+PVOID WdfMemoryGetBuffer(WDFMEMORY Memory, size_t* BufferSize)
+{
+	ShimMemory* memory = ShimGet<ShimMemory>(Memory);
+
+	if (BufferSize)
+		*BufferSize = memory->Size;
+
+	return memory->Buffer;
+}
+
+NTSTATUS WdfMemoryCopyFromBuffer(WDFMEMORY DestinationMemory, size_t DestinationOffset, PVOID Buffer, size_t NumBytesToCopyFrom)
+{
+	ShimMemory* memory = ShimGet<ShimMemory>(DestinationMemory);
+
+	if (DestinationOffset + NumBytesToCopyFrom > memory->Size)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	RtlCopyMemory(memory->Buffer + DestinationOffset, Buffer, NumBytesToCopyFrom);
+	return STATUS_SUCCESS;
+}
+
+//
+// I/O targets, forwarded to the fake SPB controller
+//
+
+NTSTATUS WdfIoTargetCreate(WDFDEVICE Device, PWDF_OBJECT_ATTRIBUTES IoTargetAttributes, WDFIOTARGET* IoTarget)
+{
+	ShimGet<ShimDevice>(Device);
+	*IoTarget = (WDFIOTARGET)(ShimObject*)ShimCreate<ShimIoTarget>(IoTargetAttributes);
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfIoTargetOpen(WDFIOTARGET IoTarget, PWDF_IO_TARGET_OPEN_PARAMS OpenParams)
+{
+	ShimIoTarget* target = ShimGet<ShimIoTarget>(IoTarget);
+	static const WCHAR prefix[] = L"\\Device\\RESOURCE_HUB\\";
+
+	if (OpenParams->Type != WdfIoTargetOpenByName ||
+		OpenParams->TargetDeviceName.Length < sizeof(prefix) - sizeof(WCHAR) ||
+		wcsncmp(OpenParams->TargetDeviceName.Buffer, prefix, ARRAYSIZE(prefix) - 1) != 0)
+		return STATUS_INVALID_PARAMETER;
+
+	if (!g_SpbTarget)
+		return STATUS_NO_SUCH_DEVICE;
+
+	target->Target = g_SpbTarget;
+	return STATUS_SUCCESS;
+}
+
+static FakeSpbTarget* ShimOpenTarget(WDFIOTARGET IoTarget)
+{
+	ShimIoTarget* target = ShimGet<ShimIoTarget>(IoTarget);
+
+	if (!target->Target)
+		ShimFatal("I/O target %p used before it was opened", IoTarget);
+
+	return target->Target;
+}
+
+static PUCHAR ShimDescriptorBuffer(PWDF_MEMORY_DESCRIPTOR Descriptor, ULONG* Length)
+{
+	if (!Descriptor) {
+		*Length = 0;
+		return NULL;
+	}
+
+	if (Descriptor->Type != WdfMemoryDescriptorTypeBuffer)
+		ShimFatal("only buffer memory descriptors are supported");
+
+	*Length = Descriptor->u.BufferType.Length;
+	return (PUCHAR)Descriptor->u.BufferType.Buffer;
+}
+
+NTSTATUS WdfIoTargetSendWriteSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, PWDF_MEMORY_DESCRIPTOR InputBuffer, PLONGLONG DeviceOffset, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesWritten)
+{
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(DeviceOffset);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	ULONG length;
+	PUCHAR buffer = ShimDescriptorBuffer(InputBuffer, &length);
+	ULONG_PTR bytes = 0;
+	NTSTATUS status = ShimOpenTarget(IoTarget)->Write(buffer, length, &bytes);
+
+	if (BytesWritten)
+		*BytesWritten = bytes;
+
+	return status;
+}
+
+NTSTATUS WdfIoTargetSendReadSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, PWDF_MEMORY_DESCRIPTOR OutputBuffer, PLONGLONG DeviceOffset, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesRead)
+{
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(DeviceOffset);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	ULONG length;
+	PUCHAR buffer = ShimDescriptorBuffer(OutputBuffer, &length);
+	ULONG_PTR bytes = 0;
+	NTSTATUS status = ShimOpenTarget(IoTarget)->Read(buffer, length, &bytes);
+
+	if (BytesRead)
+		*BytesRead = bytes;
+
+	return status;
+}
+
+NTSTATUS WdfIoTargetSendIoctlSynchronously(WDFIOTARGET IoTarget, WDFREQUEST Request, ULONG IoctlCode, PWDF_MEMORY_DESCRIPTOR InputBuffer, PWDF_MEMORY_DESCRIPTOR OutputBuffer, PWDF_REQUEST_SEND_OPTIONS RequestOptions, PULONG_PTR BytesReturned)
+{
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(OutputBuffer);
+	UNREFERENCED_PARAMETER(RequestOptions);
+
+	ULONG length;
+	PUCHAR buffer = ShimDescriptorBuffer(InputBuffer, &length);
+	ULONG_PTR bytes = 0;
+	NTSTATUS status = ShimOpenTarget(IoTarget)->Ioctl(IoctlCode, buffer, length, &bytes);
+
+	if (BytesReturned)
+		*BytesReturned = bytes;
+
+	return status;
+}
+
+//
+// Synchronization
+//
+
+NTSTATUS WdfWaitLockCreate(PWDF_OBJECT_ATTRIBUTES LockAttributes, WDFWAITLOCK* Lock)
+{
+	*Lock = (WDFWAITLOCK)(ShimObject*)ShimCreate<ShimWaitLock>(LockAttributes);
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfWaitLockAcquire(WDFWAITLOCK Lock, PLONGLONG Timeout)
+{
+	ShimWaitLock* lock = ShimGet<ShimWaitLock>(Lock);
+	LONGLONG start = g_Now;
+
+	if (lock->Owner == t_Self)
+		ShimFatal("wait lock %p acquired recursively", Lock);
+
+	if (lock->Owner) {
+		if (Timeout && *Timeout == 0)
+			return STATUS_TIMEOUT;
+
+		lock->Stats.Contentions++;
+		lock->Waiters.push_back(t_Self);
+
+		//
+		// The releasing thread hands the lock straight to the first waiter
+		//
+		if (!ShimBlock(lock, ShimDeadline(Timeout))) {
+			lock->Waiters.erase(std::find(lock->Waiters.begin(), lock->Waiters.end(), t_Self));
+			lock->Stats.Timeouts++;
+			return STATUS_TIMEOUT;
+		}
+	}
+	else {
+		lock->Owner = t_Self;
+	}
+
+	lock->Stats.Acquisitions++;
+	lock->Stats.MaxWait = max(lock->Stats.MaxWait, g_Now - start);
+	lock->AcquiredAt = g_Now;
+
+	return STATUS_SUCCESS;
+}
+
+VOID WdfWaitLockRelease(WDFWAITLOCK Lock)
+{
+	ShimWaitLock* lock = ShimGet<ShimWaitLock>(Lock);
+	LONGLONG hold = g_Now - lock->AcquiredAt;
+
+	if (lock->Owner != t_Self)
+		ShimFatal("wait lock %p released by a thread that does not own it", Lock);
+
+	lock->Stats.MaxHold = max(lock->Stats.MaxHold, hold);
+	lock->Stats.TotalHold += hold;
+	lock->Owner = nullptr;
+
+	if (!lock->Waiters.empty()) {
+		std::unique_lock<std::mutex> schedulerLock(g_SchedulerLock);
+
+		lock->Owner = lock->Waiters.front();
+		lock->Waiters.pop_front();
+		ShimWakeThread(lock->Owner);
+	}
+}
+
+SHIM_LOCK_STATS ShimWaitLockStats(WDFWAITLOCK Lock)
+{
+	return ShimGet<ShimWaitLock>(Lock)->Stats;
+}
+
+VOID ShimClearWaitLockStats(WDFWAITLOCK Lock)
+{
+	ShimGet<ShimWaitLock>(Lock)->Stats = {};
+}
+
+NTSTATUS WdfSpinLockCreate(PWDF_OBJECT_ATTRIBUTES SpinLockAttributes, WDFSPINLOCK* SpinLock)
+{
+	*SpinLock = (WDFSPINLOCK)(ShimObject*)ShimCreate<ShimSpinLock>(SpinLockAttributes);
+	return STATUS_SUCCESS;
+}
+
+VOID WdfSpinLockAcquire(WDFSPINLOCK SpinLock)
+{
+	ShimSpinLock* lock = ShimGet<ShimSpinLock>(SpinLock);
+
+	//
+	// Threads only switch on waits, and nothing may wait under a spin lock
+	//
+	if (lock->Held)
+		ShimFatal("spin lock %p acquired while held", SpinLock);
+
+	lock->Held = true;
+}
+
+VOID WdfSpinLockRelease(WDFSPINLOCK SpinLock)
+{
+	ShimSpinLock* lock = ShimGet<ShimSpinLock>(SpinLock);
+
+	if (!lock->Held)
+		ShimFatal("spin lock %p released while not held", SpinLock);
+
+	lock->Held = false;
+}
+
+//
+// Queues and requests
+//
+
+NTSTATUS WdfIoQueueCreate(WDFDEVICE Device, PWDF_IO_QUEUE_CONFIG Config, PWDF_OBJECT_ATTRIBUTES QueueAttributes, WDFQUEUE* Queue)
+{
+	ShimDevice* device = ShimGet<ShimDevice>(Device);
+	ShimQueue* queue = ShimCreate<ShimQueue>(QueueAttributes);
+
+	queue->Device = device;
+	queue->DispatchType = Config->DispatchType;
+	queue->EvtIoInternalDeviceControl = Config->EvtIoInternalDeviceControl;
+
+	if (Config->DefaultQueue)
+		device->DefaultQueue = queue;
+
+	*Queue = (WDFQUEUE)(ShimObject*)queue;
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfIoQueueRetrieveNextRequest(WDFQUEUE Queue, WDFREQUEST* OutRequest)
+{
+	ShimQueue* queue = ShimGet<ShimQueue>(Queue);
+
+	if (queue->DispatchType != WdfIoQueueDispatchManual)
+		ShimFatal("requests can only be retrieved from manual queues");
+
+	if (queue->Requests.empty()) {
+		*OutRequest = NULL;
+		return STATUS_NO_MORE_ENTRIES;
+	}
+
+	*OutRequest = queue->Requests.front();
+	queue->Requests.pop_front();
+
+	return STATUS_SUCCESS;
+}
+
+WDFDEVICE WdfIoQueueGetDevice(WDFQUEUE Queue)
+{
+	return (WDFDEVICE)(ShimObject*)ShimGet<ShimQueue>(Queue)->Device;
+}
+
+ULONG ShimQueueDepth(WDFQUEUE Queue)
+{
+	return (ULONG)ShimGet<ShimQueue>(Queue)->Requests.size();
+}
+
+WDFREQUEST ShimCreateRequest(ULONG IoControlCode, size_t OutputLength, size_t InputLength, PVOID UserBuffer, PVOID Type3InputBuffer)
+{
+	ShimRequest* request = ShimCreate<ShimRequest>(NULL);
+
+	request->IoControlCode = IoControlCode;
+	request->Output.resize(OutputLength);
+	request->Input.resize(InputLength);
+
+	//
+	// hidclass hands the minidriver its buffer in Irp->UserBuffer
+	//
+	request->Irp.UserBuffer = UserBuffer ? UserBuffer : request->Output.data();
+	request->Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength = (ULONG)OutputLength;
+	request->Irp.Stack.Parameters.DeviceIoControl.InputBufferLength = (ULONG)InputLength;
+	request->Irp.Stack.Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+	request->Irp.Stack.Parameters.DeviceIoControl.Type3InputBuffer = Type3InputBuffer;
+
+	return (WDFREQUEST)(ShimObject*)request;
+}
+
+VOID ShimDispatchRequest(WDFQUEUE Queue, WDFREQUEST Request)
+{
+	ShimQueue* queue = ShimGet<ShimQueue>(Queue);
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+
+	if (!queue->EvtIoInternalDeviceControl)
+		ShimFatal("queue %p has no internal device control callback", Queue);
+
+	queue->EvtIoInternalDeviceControl(Queue, Request,
+		request->Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength,
+		request->Irp.Stack.Parameters.DeviceIoControl.InputBufferLength,
+		request->IoControlCode);
+}
+
+BOOLEAN ShimRequestCompleted(WDFREQUEST Request)
+{
+	return ShimGet<ShimRequest>(Request)->Completed;
+}
+
+NTSTATUS ShimRequestStatus(WDFREQUEST Request)
+{
+	return ShimGet<ShimRequest>(Request)->Status;
+}
+
+ULONG_PTR ShimRequestInformation(WDFREQUEST Request)
+{
+	return ShimGet<ShimRequest>(Request)->Information;
+}
+
+PUCHAR ShimRequestOutput(WDFREQUEST Request)
+{
+	return (PUCHAR)ShimGet<ShimRequest>(Request)->Irp.UserBuffer;
+}
+
+VOID ShimDeleteRequest(WDFREQUEST Request)
+{
+	WdfObjectDelete(Request);
+}
+
+NTSTATUS WdfRequestRetrieveOutputBuffer(WDFREQUEST Request, size_t MinimumRequiredSize, PVOID* Buffer, size_t* Length)
+{
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+	size_t length = request->Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength;
+
+	if (length == 0 || length < MinimumRequiredSize)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	*Buffer = request->Irp.UserBuffer;
+	if (Length)
+		*Length = length;
+
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS WdfRequestRetrieveOutputMemory(WDFREQUEST Request, WDFMEMORY* Memory)
+{
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+
+	if (!request->OutputMemory) {
+		ShimMemory* memory = ShimCreate<ShimMemory>(NULL);
+
+		memory->Buffer = (PUCHAR)request->Irp.UserBuffer;
+		memory->Size = request->Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength;
+		request->OutputMemory = (WDFMEMORY)(ShimObject*)memory;
+	}
+
+	*Memory = request->OutputMemory;
+	return STATUS_SUCCESS;
+}
+
+VOID WdfRequestComplete(WDFREQUEST Request, NTSTATUS Status)
+{
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+
+	if (request->Completed)
+		ShimFatal("request %p completed twice", Request);
+
+	request->Completed = true;
+	request->Status = Status;
+}
+
+VOID WdfRequestCompleteWithInformation(WDFREQUEST Request, NTSTATUS Status, ULONG_PTR Information)
+{
+	WdfRequestSetInformation(Request, Information);
+	WdfRequestComplete(Request, Status);
+}
+
+VOID WdfRequestSetInformation(WDFREQUEST Request, ULONG_PTR Information)
+{
+	ShimGet<ShimRequest>(Request)->Information = Information;
+}
+
+NTSTATUS WdfRequestForwardToIoQueue(WDFREQUEST Request, WDFQUEUE DestinationQueue)
+{
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+
+	if (request->Completed)
+		ShimFatal("request %p forwarded after completion", Request);
+
+	ShimGet<ShimQueue>(DestinationQueue)->Requests.push_back(Request);
+	return STATUS_SUCCESS;
+}
+
+VOID WdfRequestGetParameters(WDFREQUEST Request, PWDF_REQUEST_PARAMETERS Parameters)
+{
+	ShimRequest* request = ShimGet<ShimRequest>(Request);
+
+	Parameters->Parameters.DeviceIoControl.OutputBufferLength = request->Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength;
+	Parameters->Parameters.DeviceIoControl.InputBufferLength = request->Irp.Stack.Parameters.DeviceIoControl.InputBufferLength;
+	Parameters->Parameters.DeviceIoControl.IoControlCode = request->IoControlCode;
+	Parameters->Parameters.DeviceIoControl.Type3InputBuffer = request->Irp.Stack.Parameters.DeviceIoControl.Type3InputBuffer;
+}
+
+PIRP WdfRequestWdmGetIrp(WDFREQUEST Request)
+{
+	return &ShimGet<ShimRequest>(Request)->Irp;
+}
+
+//
+// Interrupts and work items
+//
+
+NTSTATUS WdfInterruptCreate(WDFDEVICE Device, PWDF_INTERRUPT_CONFIG Configuration, PWDF_OBJECT_ATTRIBUTES Attributes, WDFINTERRUPT* Interrupt)
+{
+	ShimInterrupt* interrupt = ShimCreate<ShimInterrupt>(Attributes);
+
+	interrupt->Device = ShimGet<ShimDevice>(Device);
+	interrupt->Isr = Configuration->EvtInterruptIsr;
+	interrupt->WorkItem = Configuration->EvtInterruptWorkItem;
+
+	*Interrupt = (WDFINTERRUPT)(ShimObject*)interrupt;
+	return STATUS_SUCCESS;
+}
+
+WDFDEVICE WdfInterruptGetDevice(WDFINTERRUPT Interrupt)
+{
+	return (WDFDEVICE)(ShimObject*)ShimGet<ShimInterrupt>(Interrupt)->Device;
+}
+
+BOOLEAN WdfInterruptQueueWorkItemForIsr(WDFINTERRUPT Interrupt)
+{
+	ShimInterrupt* interrupt = ShimGet<ShimInterrupt>(Interrupt);
+
+	if (!interrupt->WorkItem)
+		ShimFatal("interrupt %p has no work item", Interrupt);
+
+	if (interrupt->WorkItemQueued)
+		return FALSE;
+
+	interrupt->WorkItemQueued = true;
+	return TRUE;
+}
+
+BOOLEAN ShimTriggerInterrupt(WDFINTERRUPT Interrupt)
+{
+	ShimInterrupt* interrupt = ShimGet<ShimInterrupt>(Interrupt);
+	BOOLEAN claimed = interrupt->Isr(Interrupt, 0);
+
+	if (!interrupt->DeferWorkItem)
+		ShimRunInterruptWorkItem(Interrupt);
+
+	return claimed;
+}
+
+VOID ShimDeferInterruptWorkItem(WDFINTERRUPT Interrupt, BOOLEAN Defer)
+{
+	ShimGet<ShimInterrupt>(Interrupt)->DeferWorkItem = Defer;
+}
+
+BOOLEAN ShimRunInterruptWorkItem(WDFINTERRUPT Interrupt)
+{
+	ShimInterrupt* interrupt = ShimGet<ShimInterrupt>(Interrupt);
+
+	if (!interrupt->WorkItemQueued)
+		return FALSE;
+
+	interrupt->WorkItemQueued = false;
+	interrupt->WorkItem(Interrupt, (WDFOBJECT)(ShimObject*)interrupt->Device);
+
+	return TRUE;
+}
+
+NTSTATUS WdfWorkItemCreate(PWDF_WORKITEM_CONFIG Config, PWDF_OBJECT_ATTRIBUTES Attributes, WDFWORKITEM* WorkItem)
+{
+	ShimWorkItem* workItem = ShimCreate<ShimWorkItem>(Attributes);
+
+	workItem->Routine = Config->EvtWorkItemFunc;
+
+	*WorkItem = (WDFWORKITEM)(ShimObject*)workItem;
+	return STATUS_SUCCESS;
+}
+
+VOID WdfWorkItemEnqueue(WDFWORKITEM WorkItem)
+{
+	//
+	// Runs at once, the driver's work items don't depend on running later
+	//
+	ShimGet<ShimWorkItem>(WorkItem)->Routine(WorkItem);
+}
@@ -0,0 +1,115 @@
+/*++
+
+Module Name:
+
+wdf_shim.h
+
+Abstract:
+
+Test-side controls for the host WDF shim: the virtual clock, simulated
+threads, request and interrupt plumbing and the shim's counters.
+
+Time is virtual, in 100ns ticks, and only moves when a simulated thread
+waits: on a delay, a lock, an event or a bus transfer on the fake SPB
+target. Simulated threads run one at a time, always the one that is due
+first, so a test with several threads is still deterministic.
+
+Environment:
+
+Linux host, test builds only
+
+--*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <wdf.h>
+
+#define SHIM_TICKS_PER_US			10LL
+#define SHIM_TICKS_PER_MS			(1000 * SHIM_TICKS_PER_US)
+#define SHIM_PERFORMANCE_FREQUENCY	(1000 * SHIM_TICKS_PER_MS)
+
+class FakeSpbTarget;
+
+//
+// Clears every object, counter, registry value and the clock. Call
+// before each test, no simulated threads may be left running.
+//
+VOID ShimReset();
+
+//
+// Virtual clock
+//
+LONGLONG ShimNow();
+VOID ShimSleep(LONGLONG Ticks);
+VOID ShimSleepUntil(LONGLONG Time);
+
+//
+// Simulated threads. Routine starts at the current virtual time and
+// runs whenever it is the earliest thread due. ShimJoinThreads waits,
+// in virtual time, for all of them to return.
+//
+VOID ShimStartThread(std::function<void()> Routine);
+VOID ShimJoinThreads();
+
+//
+// Environment the driver runs against
+//
+VOID ShimSetSpbTarget(FakeSpbTarget* Target);
+VOID ShimSetRegistryULong(PCWSTR Name, ULONG Value);
+
+PWDFDEVICE_INIT ShimCreateDeviceInit();
+WDFDEVICE ShimDeviceInitGetDevice(PWDFDEVICE_INIT DeviceInit);
+WDFCMRESLIST ShimCreateI2cResourceList(ULONG IdLowPart, ULONG IdHighPart);
+
+WDFQUEUE ShimDeviceDefaultQueue(WDFDEVICE Device);
+WDF_DEVICE_FAILED_ACTION ShimDeviceFailedAction(WDFDEVICE Device);
+ULONG ShimQueueDepth(WDFQUEUE Queue);
+
+//
+// Requests as hidclass would send them. UserBuffer is what the driver
+// finds in Irp->UserBuffer, Type3InputBuffer the METHOD_NEITHER input.
+//
+WDFREQUEST ShimCreateRequest(ULONG IoControlCode, size_t OutputLength, size_t InputLength = 0, PVOID UserBuffer = NULL, PVOID Type3InputBuffer = NULL);
+VOID ShimDispatchRequest(WDFQUEUE Queue, WDFREQUEST Request);
+BOOLEAN ShimRequestCompleted(WDFREQUEST Request);
+NTSTATUS ShimRequestStatus(WDFREQUEST Request);
+ULONG_PTR ShimRequestInformation(WDFREQUEST Request);
+PUCHAR ShimRequestOutput(WDFREQUEST Request);
+VOID ShimDeleteRequest(WDFREQUEST Request);
+
+//
+// Interrupts. ShimTriggerInterrupt runs the ISR on the calling thread
+// and then the work item it queued, unless work items are deferred, in
+// which case ShimRunInterruptWorkItem runs it later.
+//
+BOOLEAN ShimTriggerInterrupt(WDFINTERRUPT Interrupt);
+VOID ShimDeferInterruptWorkItem(WDFINTERRUPT Interrupt, BOOLEAN Defer);
+BOOLEAN ShimRunInterruptWorkItem(WDFINTERRUPT Interrupt);
+
+//
+// Counters
+//
+typedef struct _SHIM_LOCK_STATS {
+	ULONG Acquisitions;
+	ULONG Contentions;
+	ULONG Timeouts;
+	LONGLONG MaxWait;
+	LONGLONG MaxHold;
+	LONGLONG TotalHold;
+} SHIM_LOCK_STATS;
+
+SHIM_LOCK_STATS ShimWaitLockStats(WDFWAITLOCK Lock);
+VOID ShimClearWaitLockStats(WDFWAITLOCK Lock);
+
+ULONG ShimPoolAllocations();
+ULONG ShimMemoryAllocations();
+
+//
+// Bytes moved by RtlCopyMemory and RtlMoveMemory. Structure assignments
+// don't go through them and aren't counted.
+//
+ULONGLONG ShimBytesCopied();
+LONG ShimOutstandingPool();
@@ -1,6 +1,10 @@
 #define DESCRIPTOR_DEF
 #include "raydium_i2c.h"
 
+#if defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 static ULONG RaydDebugLevel = 100;
 static ULONG RaydDebugCatagories = DBG_INIT || DBG_PNP || DBG_IOCTL;
 
@@ -48,215 +52,775 @@ struct raydium_bank_switch_header {
 };
 #include <poppack.h>
 
-static NTSTATUS raydium_i2c_send(PRAYD_CONTEXT pDevice, UINT32 addr, const UINT8* data, UINT32 len) {
-	NTSTATUS status;
+//
+// Register transaction batch, run under a single lock acquisition
+//
+
+#define RAYD_I2C_BATCH_MAX	4
+
+typedef enum _RAYD_I2C_OP_TYPE {
+	RaydI2COpWrite = 0,
+	RaydI2COpRead
+} RAYD_I2C_OP_TYPE;
+
+typedef struct _RAYD_I2C_OP {
+	RAYD_I2C_OP_TYPE Type;
+	UINT32 Addr;
+	const UINT32* AddrRef;
+	UINT8* Data;
+	UINT32 Len;
+	UINT32 ChunkSize;
+} RAYD_I2C_OP, *PRAYD_I2C_OP;
+
+typedef struct _RAYD_I2C_BATCH {
+	RAYD_I2C_OP Ops[RAYD_I2C_BATCH_MAX];
+	ULONG Count;
+	BOOLEAN FrameRead;
+	BOOLEAN NoRetry;
+} RAYD_I2C_BATCH, *PRAYD_I2C_BATCH;
+
+static BOOLEAN raydium_i2c_need_bank_switch(PRAYD_CONTEXT pDevice, UINT32 addr) {
+	SPB_CONTEXT* spb = &pDevice->I2CContext;
+
+	if (addr <= 0xFF)
+		return false;
 
-	UINT8 regAddr = addr & 0xFF;
-	UINT8 *txBuf = (UINT8 *)ExAllocatePool2(POOL_FLAG_NON_PAGED, len + 1, RAYD_POOL_TAG);
-	if (!txBuf) {
-		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"Failed to allocate txBuf\n");
-		return STATUS_NO_MEMORY;
+	if (spb->BankValid && spb->CurrentBank == (addr & ~0xFFUL)) {
+		spb->BankSwitchesElided++;
+		return false;
 	}
+	return true;
+}
+
+static void raydium_i2c_bank_selected(PRAYD_CONTEXT pDevice, UINT32 addr) {
+	pDevice->I2CContext.CurrentBank = addr & ~0xFFUL;
+	pDevice->I2CContext.BankValid = true;
+	pDevice->I2CContext.BankSwitchesIssued++;
+}
+
+static void raydium_i2c_invalidate_bank(PRAYD_CONTEXT pDevice) {
+	pDevice->I2CContext.BankValid = false;
+}
+
+//
+// Takes the SPB wait lock. Timing out on it fails with STATUS_DEVICE_BUSY,
+// which callers can tell apart from a failed transfer.
+//
+static NTSTATUS raydium_i2c_lock(PRAYD_CONTEXT pDevice, BOOLEAN frameRead) {
+	NTSTATUS status;
 
 	LONGLONG Timeout;
-	Timeout = -10 * 1000;
-	status = WdfWaitLockAcquire(pDevice->I2CContext.SpbLock, &Timeout);
-	if (status == STATUS_TIMEOUT) {
-		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"Timed out trying to acquire lock for write\n");
-		return STATUS_IO_TIMEOUT;
-	}
+	if (frameRead) {
+		LONGLONG waitStart = KeQueryPerformanceCounter(NULL).QuadPart;
+		LONGLONG waited;
 
-	txBuf[0] = regAddr;
-	RtlCopyMemory(txBuf + 1, data, len);
+		Timeout = -10 * 1000 * RM_FRAME_LOCK_TIMEOUT_MS;
+		status = WdfWaitLockAcquire(pDevice->I2CContext.SpbLock, &Timeout);
 
-	status = SpbLockController(&pDevice->I2CContext); //Perform as a single i2c transfer transaction
-	if (!NT_SUCCESS(status))
-	{
-		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"Failed to lock controller with status 0x%x\n", status);
-		goto exit;
-	}
+		waited = KeQueryPerformanceCounter(NULL).QuadPart - waitStart;
+		if (waited > pDevice->MaxFrameLockWait)
+			pDevice->MaxFrameLockWait = waited;
 
-	int tries = 0;
-	do {
-		struct raydium_bank_switch_header header;
-		header.cmd = RM_CMD_BANK_SWITCH,
-		header.be_addr = RtlUlongByteSwap(addr);
+		if (status == STATUS_TIMEOUT) {
+			pDevice->FrameLockTimeouts++;
+			return STATUS_DEVICE_BUSY;
+		}
+	}
+	else {
+		//
+		// Control traffic only fits into the gaps between frame reads. Wait
+		// for the interrupt path to go idle, and back out again if a frame
+		// read arrived while we were taking the lock.
+		//
+		for (;;) {
+			LARGE_INTEGER Interval;
+			Interval.QuadPart = -10 * 1000 * RM_CONTROL_LOCK_TIMEOUT_MS;
+			status = KeWaitForSingleObject(&pDevice->FrameReadIdle, Executive, KernelMode, FALSE, &Interval);
+			if (status == STATUS_TIMEOUT) {
+				return STATUS_DEVICE_BUSY;
+			}
 
-		if (addr > 0xFF) { //need to send RM_CMD_BANK_SWITCH first
-			status = SpbWriteDataSynchronously(&pDevice->I2CContext, &header, sizeof(header));
-			if (!NT_SUCCESS(status)) {
-				RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-					"Failed to send RM_CMD_BANK_SWITCH 0x%x\n", status);
-				goto retry;
+			Timeout = -10 * 1000 * RM_CONTROL_LOCK_TIMEOUT_MS;
+			status = WdfWaitLockAcquire(pDevice->I2CContext.SpbLock, &Timeout);
+			if (status == STATUS_TIMEOUT) {
+				return STATUS_DEVICE_BUSY;
 			}
-		}
 
-		status = SpbWriteDataSynchronously(&pDevice->I2CContext, txBuf, len + 1);
-		if (!NT_SUCCESS(status)) {
-			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-				"Failed to send data 0x%x\n", status);
-			goto retry;
+			if (pDevice->FrameReadsPending == 0)
+				break;
+
+			WdfWaitLockRelease(pDevice->I2CContext.SpbLock);
 		}
-		break;
-	retry:
-		LARGE_INTEGER Interval;
-		Interval.QuadPart = -10 * 1000 * RM_RETRY_DELAY_MS;
-		KeDelayExecutionThread(KernelMode, FALSE, &Interval);
-	} while (++tries < RM_MAX_RETRIES);
+	}
 
-exit:
-	SpbUnlockController(&pDevice->I2CContext);
+	//
+	// The controller itself is only locked around multi-transfer writes
+	// and the separate transfers of the sequence fallback, SpbCx rejects
+	// sequences from a client holding it
+	//
+	return status;
+}
 
-	ExFreePoolWithTag(txBuf, RAYD_POOL_TAG);
+static void raydium_frame_read_begin(PRAYD_CONTEXT pDevice) {
+	if (InterlockedIncrement(&pDevice->FrameReadsPending) == 1)
+		KeClearEvent(&pDevice->FrameReadIdle);
+}
+
+static void raydium_frame_read_end(PRAYD_CONTEXT pDevice) {
+	if (InterlockedDecrement(&pDevice->FrameReadsPending) == 0)
+		KeSetEvent(&pDevice->FrameReadIdle, IO_NO_INCREMENT, FALSE);
+}
 
+static void raydium_i2c_unlock(PRAYD_CONTEXT pDevice) {
 	WdfWaitLockRelease(pDevice->I2CContext.SpbLock);
+}
 
-	return status;
+static void raydium_i2c_backoff(PRAYD_CONTEXT pDevice, ULONG attempt) {
+	ULONG delayMs = pDevice->RetryPolicy.BaseDelayMs << min(attempt, 8);
+
+	if (delayMs > pDevice->RetryPolicy.MaxDelayMs)
+		delayMs = pDevice->RetryPolicy.MaxDelayMs;
+
+	//
+	// Up to 50% jitter so retries don't line up with other bus traffic
+	//
+	delayMs += RtlRandomEx(&pDevice->RetrySeed) % (delayMs / 2 + 1);
+
+	LARGE_INTEGER Interval;
+	Interval.QuadPart = -10 * 1000 * (LONGLONG)delayMs;
+	KeDelayExecutionThread(KernelMode, FALSE, &Interval);
 }
 
-static NTSTATUS raydium_i2c_readSubset(PRAYD_CONTEXT pDevice, UINT32 addr, UINT8* data, UINT32 len) {
+static NTSTATUS raydium_i2c_write_locked(PRAYD_CONTEXT pDevice, UINT32 addr, const UINT8* data, UINT32 len) {
 	NTSTATUS status;
+	BOOLEAN bankSwitch;
 
 	UINT8 regAddr = addr & 0xFF;
 
-	LONGLONG Timeout;
-	Timeout = -10 * 1000;
-	status = WdfWaitLockAcquire(pDevice->I2CContext.SpbLock, &Timeout);
-	if (status == STATUS_TIMEOUT) {
-		return STATUS_IO_TIMEOUT;
-	}
-
-	status = SpbLockController(&pDevice->I2CContext); //Perform as a single i2c transfer transaction
-	if (!NT_SUCCESS(status))
-	{
-		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"Failed to lock controller with status 0x%x\n", status);
-		goto exit;
-	}
+	bankSwitch = raydium_i2c_need_bank_switch(pDevice, addr);
+	if (bankSwitch) { //need to send RM_CMD_BANK_SWITCH first
+		struct raydium_bank_switch_header header;
+		header.cmd = RM_CMD_BANK_SWITCH,
+		header.be_addr = RtlUlongByteSwap(addr);
 
-	struct raydium_bank_switch_header header;
-	header.cmd = RM_CMD_BANK_SWITCH,
-	header.be_addr = RtlUlongByteSwap(addr);
+		//
+		// Keep other clients off the bus between the bank switch and
+		// the write
+		//
+		status = SpbLockController(&pDevice->I2CContext);
+		if (!NT_SUCCESS(status)) {
+			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+				"Failed to lock controller with status 0x%x\n", status);
+			return status;
+		}
 
-	if (addr > 0xFF) { //need to send RM_CMD_BANK_SWITCH first
 		status = SpbWriteDataSynchronously(&pDevice->I2CContext, &header, sizeof(header));
 		if (!NT_SUCCESS(status)) {
 			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
 				"Failed to send RM_CMD_BANK_SWITCH 0x%x\n", status);
-			goto exit;
+			SpbUnlockController(&pDevice->I2CContext);
+			raydium_i2c_invalidate_bank(pDevice);
+			return status;
 		}
+		raydium_i2c_bank_selected(pDevice, addr);
 	}
 
-	status = SpbXferDataSynchronously(&pDevice->I2CContext, &regAddr, 1, (PVOID)data, len);
+	status = SpbWriteRegisterSynchronously(&pDevice->I2CContext, regAddr, (PVOID)data, len);
+
+	if (bankSwitch)
+		SpbUnlockController(&pDevice->I2CContext);
+
 	if (!NT_SUCCESS(status)) {
 		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"Failed to xfer data 0x%x\n", status);
-		goto exit;
+			"Failed to send data 0x%x\n", status);
+		raydium_i2c_invalidate_bank(pDevice);
 	}
-
-exit:
-	SpbUnlockController(&pDevice->I2CContext);
-
-	WdfWaitLockRelease(pDevice->I2CContext.SpbLock);
-
 	return status;
 }
 
-static NTSTATUS raydium_i2c_read(PRAYD_CONTEXT pDevice, UINT32 addr, UINT8* data, UINT32 len) {
+static NTSTATUS raydium_i2c_read_locked(PRAYD_CONTEXT pDevice, UINT32 addr, UINT8* data, UINT32 len, UINT32 chunkSize, UINT32* completed) {
 	NTSTATUS status = STATUS_SUCCESS;
 
-	while (len) {
-		UINT32 xfer_len = min(len, RM_MAX_READ_SIZE);
+	//
+	// Caller holds the SPB wait lock, so every chunk of the burst goes
+	// out back to back and the bank only needs selecting when the chunk
+	// lands in a different 256 byte page than the one last selected.
+	// Each chunk is one sequence, sent without the controller lock.
+	// Reading starts at *completed so a retry resumes at the chunk
+	// that failed instead of the start of the buffer.
+	//
+	while (*completed < len) {
+		UINT32 chunk_addr = addr + *completed;
+		UINT32 xfer_len = min(len - *completed, chunkSize);
+		UINT8 regAddr = chunk_addr & 0xFF;
+		struct raydium_bank_switch_header header;
+		PVOID prefix = NULL;
+		ULONG prefixLength = 0;
+
+		if (raydium_i2c_need_bank_switch(pDevice, chunk_addr)) { //need to send RM_CMD_BANK_SWITCH first
+			header.cmd = RM_CMD_BANK_SWITCH,
+			header.be_addr = RtlUlongByteSwap(chunk_addr);
+
+			prefix = &header;
+			prefixLength = sizeof(header);
+		}
 
-		status = raydium_i2c_readSubset(pDevice, addr, data, xfer_len);
+		status = SpbXferSequenceSynchronously(&pDevice->I2CContext, prefix, prefixLength, &regAddr, 1, (PVOID)(data + *completed), xfer_len);
 		if (!NT_SUCCESS(status)) {
 			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-				"subset read failed! (read %d of %d)\n", total_len - len, total_len);
+				"subset read failed! (read %d of %d)\n", *completed, len);
+			raydium_i2c_invalidate_bank(pDevice);
 			return status;
 		}
 
-		len -= xfer_len;
-		data += xfer_len;
-		addr += xfer_len;
+		if (prefix) {
+			raydium_i2c_bank_selected(pDevice, chunk_addr);
+		}
+
+		*completed += xfer_len;
+	}
+	return status;
+}
+
+static void raydium_i2c_batch_init(PRAYD_I2C_BATCH batch) {
+	batch->Count = 0;
+	batch->FrameRead = false;
+	batch->NoRetry = false;
+}
+
+static void raydium_i2c_batch_add(PRAYD_I2C_BATCH batch, RAYD_I2C_OP_TYPE type, UINT32 addr, const UINT32* addrRef, UINT8* data, UINT32 len) {
+	NT_ASSERT(batch->Count < RAYD_I2C_BATCH_MAX);
+
+	PRAYD_I2C_OP op = &batch->Ops[batch->Count++];
+	op->Type = type;
+	op->Addr = addr;
+	op->AddrRef = addrRef;
+	op->Data = data;
+	op->Len = len;
+	op->ChunkSize = RM_MAX_READ_SIZE;
+}
+
+static void raydium_i2c_batch_write(PRAYD_I2C_BATCH batch, UINT32 addr, const UINT8* data, UINT32 len) {
+	raydium_i2c_batch_add(batch, RaydI2COpWrite, addr, NULL, (UINT8*)data, len);
+}
+
+static void raydium_i2c_batch_read(PRAYD_I2C_BATCH batch, UINT32 addr, UINT8* data, UINT32 len) {
+	raydium_i2c_batch_add(batch, RaydI2COpRead, addr, NULL, data, len);
+}
+
+//
+// Reads from an address that an earlier read in the same batch fetches
+//
+static void raydium_i2c_batch_read_indirect(PRAYD_I2C_BATCH batch, const UINT32* addrRef, UINT8* data, UINT32 len) {
+	raydium_i2c_batch_add(batch, RaydI2COpRead, 0, addrRef, data, len);
+}
+
+static NTSTATUS raydium_i2c_batch_execute(PRAYD_CONTEXT pDevice, PRAYD_I2C_BATCH batch) {
+	NTSTATUS status = STATUS_SUCCESS;
+	ULONG index = 0;
+	UINT32 completed = 0;
+	ULONG tries = 0;
+
+	//
+	// All queued operations run under one lock acquisition. On a failure
+	// the lock is dropped, control traffic backs off, and the batch
+	// resumes at the operation (and chunk) that failed.
+	//
+	while (index < batch->Count) {
+		ULONG progressIndex = index;
+		UINT32 progress = completed;
+		BOOLEAN yield = false;
+
+		status = raydium_i2c_lock(pDevice, batch->FrameRead);
+		if (NT_SUCCESS(status)) {
+			for (; index < batch->Count; index++, completed = 0) {
+				PRAYD_I2C_OP op = &batch->Ops[index];
+				UINT32 addr = op->AddrRef ? *op->AddrRef : op->Addr;
+
+				if (op->Type == RaydI2COpWrite)
+					status = raydium_i2c_write_locked(pDevice, addr, op->Data, op->Len);
+				else
+					status = raydium_i2c_read_locked(pDevice, addr, op->Data, op->Len, op->ChunkSize, &completed);
+
+				if (!NT_SUCCESS(status))
+					break;
+
+				//
+				// Let a pending frame read have the bus before the next
+				// control operation
+				//
+				if (!batch->FrameRead && pDevice->FrameReadsPending &&
+					index + 1 < batch->Count) {
+					yield = true;
+					index++;
+					completed = 0;
+					break;
+				}
+			}
+
+			raydium_i2c_unlock(pDevice);
+
+			if (yield) {
+				pDevice->ControlYields++;
+				continue;
+			}
+
+			if (NT_SUCCESS(status))
+				break;
+		}
+
+		//
+		// Each operation and chunk gets its own retry budget
+		//
+		if (index != progressIndex || completed != progress)
+			tries = 0;
+
+		if (batch->NoRetry || ++tries >= pDevice->RetryPolicy.MaxTries)
+			break;
+
+		pDevice->I2CRetries++;
+
+		//
+		// Frame reads run in the ISR with the interrupt masked, so they
+		// retry straight away and only control traffic backs off
+		//
+		if (!batch->FrameRead)
+			raydium_i2c_backoff(pDevice, tries - 1);
+	}
+
+	return status;
+}
+
+static NTSTATUS raydium_i2c_send(PRAYD_CONTEXT pDevice, UINT32 addr, const UINT8* data, UINT32 len) {
+	RAYD_I2C_BATCH batch;
+
+	raydium_i2c_batch_init(&batch);
+	raydium_i2c_batch_write(&batch, addr, data, len);
+
+	return raydium_i2c_batch_execute(pDevice, &batch);
+}
+
+static NTSTATUS raydium_i2c_read(PRAYD_CONTEXT pDevice, UINT32 addr, UINT8* data, UINT32 len) {
+	RAYD_I2C_BATCH batch;
+
+	raydium_i2c_batch_init(&batch);
+	raydium_i2c_batch_read(&batch, addr, data, len);
+
+	return raydium_i2c_batch_execute(pDevice, &batch);
+}
+
+static NTSTATUS raydium_i2c_read_frame(PRAYD_CONTEXT pDevice, UINT8* data, UINT32 chunkSize) {
+	RAYD_I2C_BATCH batch;
+
+	raydium_i2c_batch_init(&batch);
+	raydium_i2c_batch_read(&batch, pDevice->dataBankAddr, data, pDevice->packageSize);
+	batch.Ops[0].ChunkSize = chunkSize;
+	batch.FrameRead = true;
+
+	return raydium_i2c_batch_execute(pDevice, &batch);
+}
+
+static inline UINT16 raydium_get_le16(const UINT8* buf)
+{
+	return (UINT16)(buf[0] | (buf[1] << 8));
+}
+
+static UINT16 raydium_calc_chksum(const UINT8* buf, UINT16 len)
+{
+	UINT32 checksum = 0;
+	UINT16 i = 0;
+
+#if defined(_M_X64)
+	//
+	// PSADBW against zero sums each 8 byte half of a 16 byte block. SSE2
+	// is always available and usable in kernel mode on x64, other
+	// architectures take the byte loop below.
+	//
+	__m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i*)&buf[i]);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(block, zero));
+	}
+
+	checksum = (UINT32)_mm_cvtsi128_si32(sum) +
+		(UINT32)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#endif
+
+	for (; i < len; i++)
+		checksum += buf[i];
+
+	//
+	// The firmware checksum is the 16 bit wrapping byte sum
+	//
+	return (UINT16)checksum;
+}
+
+static BOOLEAN raydium_check_frame(PRAYD_CONTEXT pDevice, UINT8* reportData) {
+	UINT16 fw_crc = raydium_get_le16(&reportData[pDevice->reportSize]);
+	UINT16 calc_crc = raydium_calc_chksum(reportData, pDevice->reportSize);
+	if (fw_crc != calc_crc) {
+		RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Invalid raydium crc %#04x vs %#04x\n", calc_crc, fw_crc);
+		return false;
+	}
+	return true;
+}
+
+static void raydium_probe_chunk_size(PRAYD_CONTEXT pDevice) {
+	const UINT32 candidates[] = { pDevice->packageSize, RM_PROBE_READ_SIZE };
+
+	pDevice->ReadChunkSize = RM_MAX_READ_SIZE;
+	pDevice->ChunkFailures = 0;
+
+	//
+	// Try the largest chunk first and settle on the first size that
+	// reads back several checksum-clean packets in a row
+	//
+	for (ULONG i = 0; i < ARRAYSIZE(candidates); i++) {
+		UINT32 chunkSize = candidates[i];
+		int reads;
+
+		if (chunkSize <= RM_MAX_READ_SIZE || chunkSize > pDevice->packageSize)
+			continue;
+
+		for (reads = 0; reads < RM_PROBE_READS; reads++) {
+			if (!NT_SUCCESS(raydium_i2c_read_frame(pDevice, pDevice->reportData[0], chunkSize)) ||
+				!raydium_check_frame(pDevice, pDevice->reportData[0]))
+				break;
+		}
+
+		if (reads == RM_PROBE_READS) {
+			pDevice->ReadChunkSize = chunkSize;
+			break;
+		}
+	}
+
+	RaydPrint(DEBUG_LEVEL_INFO, DBG_INIT, "Raydium data bank read size %d (packet %d)\n", pDevice->ReadChunkSize, pDevice->packageSize);
+}
+
+static void raydium_track_chunk_size(PRAYD_CONTEXT pDevice, NTSTATUS status) {
+	if (pDevice->ReadChunkSize <= RM_MAX_READ_SIZE)
+		return;
+
+	if (NT_SUCCESS(status)) {
+		pDevice->ChunkFailures = 0;
+		return;
+	}
+
+	//
+	// Only failed transfers and checksum mismatches say anything about the
+	// read size, a frame that lost the bus to control traffic does not
+	//
+	if (status == STATUS_DEVICE_BUSY)
+		return;
+
+	//
+	// The probed size stopped being reliable, go back to the size every
+	// controller handles
+	//
+	if (++pDevice->ChunkFailures >= RM_CHUNK_MAX_FAILURES) {
+		RaydPrint(DEBUG_LEVEL_INFO, DBG_INIT, "Raydium falling back to %d byte reads after %d failures\n", RM_MAX_READ_SIZE, pDevice->ChunkFailures);
+
+		pDevice->ReadChunkSize = RM_MAX_READ_SIZE;
+		pDevice->ChunkFailures = 0;
+		pDevice->ChunkFallbacks++;
+	}
+}
+
+//
+// Reads the hello packet once, without the transfer retries, so callers
+// can poll it while the controller is coming up
+//
+static NTSTATUS raydium_i2c_check_fw_status(PRAYD_CONTEXT pDevice) {
+	static const UINT8 bl_ack = 0x62;
+	static const UINT8 main_ack = 0x66;
+	UINT8 buf[4];
+	RAYD_I2C_BATCH batch;
+	NTSTATUS status;
+
+	raydium_i2c_batch_init(&batch);
+	raydium_i2c_batch_read(&batch, RM_CMD_BOOT_READ, buf, sizeof(buf));
+	batch.NoRetry = true;
+
+	status = raydium_i2c_batch_execute(pDevice, &batch);
+	if (NT_SUCCESS(status)) {
+		if (buf[0] == bl_ack)
+			pDevice->bootMode = RAYDIUM_TS_BLDR;
+		else if (buf[0] == main_ack)
+			pDevice->bootMode = RAYDIUM_TS_MAIN;
+		else
+			return STATUS_DEVICE_NOT_READY;
+		return status;
+	}
+	return status;
+}
+
+//
+// Polls the hello packet at growing intervals until the controller acks
+// from its main firmware, giving up once deadlineMs has passed. The fixed
+// delays the controller is specified for serve as the deadline, most
+// units answer well before it. The bootloader can ack briefly on its way
+// to main firmware, so its ack only stands once the deadline is reached.
+//
+static NTSTATUS raydium_i2c_wait_ready(PRAYD_CONTEXT pDevice, ULONG deadlineMs, ULONG* readyUs) {
+	LONGLONG start = KeQueryPerformanceCounter(NULL).QuadPart;
+	LONGLONG elapsed;
+	ULONG intervalMs = RM_READY_POLL_MIN_MS;
+	BOOLEAN bootloader = false;
+	NTSTATUS status;
+
+	for (;;) {
+		LARGE_INTEGER Interval;
+		Interval.QuadPart = -10 * 1000 * (LONGLONG)intervalMs;
+		KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+
+		status = raydium_i2c_check_fw_status(pDevice);
+
+		elapsed = (KeQueryPerformanceCounter(NULL).QuadPart - start) * 1000000 / pDevice->PerformanceFrequency;
+		if (NT_SUCCESS(status) && pDevice->bootMode == RAYDIUM_TS_MAIN)
+			break;
+
+		if (NT_SUCCESS(status))
+			bootloader = true;
+
+		if (elapsed >= (LONGLONG)deadlineMs * 1000)
+			break;
+
+		intervalMs = min(intervalMs * 2, RM_READY_POLL_MAX_MS);
+	}
+
+	*readyUs = (ULONG)elapsed;
+
+	if (!NT_SUCCESS(status) || pDevice->bootMode != RAYDIUM_TS_MAIN) {
+		pDevice->ReadyTimeouts++;
+
+		if (bootloader) {
+			pDevice->bootMode = RAYDIUM_TS_BLDR;
+			status = STATUS_SUCCESS;
+		}
 	}
+
 	return status;
 }
 
-static NTSTATUS raydium_i2c_sw_reset(_In_ PRAYD_CONTEXT pDevice)
+//
+// Resets the controller and polls it until it answers. readyStatus gets
+// the poll's result, with bootMode set from the last hello packet read.
+//
+static NTSTATUS raydium_i2c_sw_reset(_In_ PRAYD_CONTEXT pDevice, _Out_ NTSTATUS* readyStatus)
 {
 	const UINT8 soft_rst_cmd = 0x01;
 	NTSTATUS status;
 
+	*readyStatus = STATUS_DEVICE_NOT_READY;
+
 	status = raydium_i2c_send(pDevice, RM_RESET_MSG_ADDR, &soft_rst_cmd,
 		sizeof(soft_rst_cmd));
+
+	//
+	// The controller forgets its selected bank across a reset
+	//
+	raydium_i2c_invalidate_bank(pDevice);
+
 	if (!NT_SUCCESS(status)) {
 		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
 			"software reset failed: %d\n", status);
 		return status;
 	}
 
-	LARGE_INTEGER Interval;
-	Interval.QuadPart = -10 * 1000 * RM_RESET_DELAY_MSEC;
-	KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+	//
+	// A controller that does not answer in time is left to the hello
+	// retries in BOOTTOUCHSCREEN
+	//
+	*readyStatus = raydium_i2c_wait_ready(pDevice, RM_RESET_DELAY_MSEC, &pDevice->ResetReadyUs);
 
 	return 0;
 }
 
+static_assert(FIELD_OFFSET(struct raydium_contact, state) == RM_CONTACT_STATE_POS, "contact layout");
+static_assert(FIELD_OFFSET(struct raydium_contact, x) == RM_CONTACT_X_POS, "contact layout");
+static_assert(FIELD_OFFSET(struct raydium_contact, y) == RM_CONTACT_Y_POS, "contact layout");
+static_assert(FIELD_OFFSET(struct raydium_contact, width_x) == RM_CONTACT_WIDTH_X_POS, "contact layout");
+static_assert(FIELD_OFFSET(struct raydium_contact, width_y) == RM_CONTACT_WIDTH_Y_POS, "contact layout");
+
+static FORCEINLINE void raydium_decode_contact(PRAYD_CONTEXT pDevice, int slot, const struct raydium_contact* contact) {
+	ULONG bit = 1UL << slot;
+	USHORT x, y, area;
+
+	if (!contact->state) {
+		//
+		// Idle slots that were idle last frame have nothing to update
+		//
+		if (!((pDevice->DownSlots | pDevice->ReleasedSlots) & bit))
+			return;
+
+		if (pDevice->DownSlots & bit) {
+			pDevice->DownSlots &= ~bit;
+			pDevice->ReleasedSlots |= bit;
+		} else {
+			pDevice->ReleasedSlots &= ~bit;
+		}
+
+		pDevice->FrameChanged = true;
+		return;
+	}
+
+	if (!(pDevice->DownSlots & bit)) {
+		pDevice->DownSlots |= bit;
+		pDevice->ReleasedSlots &= ~bit;
+		pDevice->FrameChanged = true;
+	}
+
+	x = raydium_get_le16(contact->x);
+	y = raydium_get_le16(contact->y);
+	area = max(contact->width_x, contact->width_y);
+
+	if (x != pDevice->XValue[slot] || y != pDevice->YValue[slot] || area != pDevice->AREA[slot])
+		pDevice->FrameChanged = true;
+
+	pDevice->XValue[slot] = x;
+	pDevice->YValue[slot] = y;
+	pDevice->AREA[slot] = area;
+}
+
+//
+// Decoder for a layout known at compile time, the record stride and slot
+// count are constants so the loop unrolls
+//
+template <UINT8 ContactSize, UINT8 Slots>
+static void raydium_decode_fixed(PRAYD_CONTEXT pDevice, const UINT8* reportData) {
+	static_assert(ContactSize >= sizeof(struct raydium_contact), "contact record too small");
+	static_assert(Slots <= RAYD_MAX_CONTACT_SLOTS, "too many contact slots");
+
+	for (int i = 0; i < Slots; i++)
+		raydium_decode_contact(pDevice, i, (const struct raydium_contact*)&reportData[ContactSize * i]);
+}
+
+static void raydium_decode_generic(PRAYD_CONTEXT pDevice, const UINT8* reportData) {
+	for (int i = 0; i < pDevice->contactSlots; i++)
+		raydium_decode_contact(pDevice, i, (const struct raydium_contact*)&reportData[pDevice->contactSize * i]);
+}
+
+static const struct {
+	UINT8 ContactSize;
+	UINT8 Slots;
+	PRAYD_DECODE_FRAME Decode;
+} raydium_decoders[] = {
+	{ 8, 10, raydium_decode_fixed<8, 10> },
+	{ 8, 5, raydium_decode_fixed<8, 5> },
+	{ 10, 10, raydium_decode_fixed<10, 10> },
+	{ 16, 10, raydium_decode_fixed<16, 10> },
+};
+
+static void raydium_set_report_layout(PRAYD_CONTEXT pDevice) {
+	pDevice->ContactsPerReport = pDevice->ContactsPerReportSetting;
+
+	if (pDevice->ContactsPerReport == 0 || pDevice->ContactsPerReport > pDevice->ContactCapacity)
+		pDevice->ContactsPerReport = pDevice->ContactCapacity;
+
+	pDevice->ReportLength = FIELD_OFFSET(RaydMultiTouchReport, Touch) +
+		pDevice->ContactsPerReport * sizeof(TOUCH) +
+		sizeof(RaydMultiTouchReport) - FIELD_OFFSET(RaydMultiTouchReport, ScanTime);
+}
+
+static NTSTATUS raydium_select_decoder(PRAYD_CONTEXT pDevice) {
+	UINT32 slots;
+
+	//
+	// Firmware that reports no contact record, or one too short to hold
+	// the fields we read, would have us divide by zero or read past the
+	// record
+	//
+	if (pDevice->contactSize < sizeof(struct raydium_contact) ||
+		pDevice->packageSize <= RM_PACKET_CRC_SIZE) {
+		RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Unsupported packet layout %d / %d\n", pDevice->packageSize, pDevice->contactSize);
+		return STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	slots = min(pDevice->reportSize / pDevice->contactSize, RAYD_MAX_CONTACT_SLOTS);
+	if (slots == 0) {
+		RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Packet %d has no room for a %d byte contact\n", pDevice->packageSize, pDevice->contactSize);
+		return STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	pDevice->contactSlots = (UINT8)slots;
+	pDevice->DecodeFrame = raydium_decode_generic;
+
+	//
+	// Report as many contacts as the firmware has slots for
+	//
+	pDevice->ContactCapacity = slots;
+	raydium_set_report_layout(pDevice);
+
+	for (ULONG i = 0; i < ARRAYSIZE(raydium_decoders); i++) {
+		if (raydium_decoders[i].ContactSize == pDevice->contactSize &&
+			raydium_decoders[i].Slots == slots) {
+			pDevice->DecodeFrame = raydium_decoders[i].Decode;
+			break;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
 static NTSTATUS raydium_i2c_query_ts_info(_In_ PRAYD_CONTEXT pDevice) {
 	struct raydium_data_info data_info;
 	UINT32 queryBankAddr;
+	RAYD_I2C_BATCH batch;
 
 	NTSTATUS status;
-	int retry_cnt;
 
-	for (retry_cnt = 0; retry_cnt < RM_MAX_RETRIES; retry_cnt++) {
-		status = raydium_i2c_read(pDevice, RM_CMD_DATA_BANK, (UINT8 *)&data_info, sizeof(data_info));
-		if (!NT_SUCCESS(status))
-			continue;
+	raydium_i2c_batch_init(&batch);
+	raydium_i2c_batch_read(&batch, RM_CMD_DATA_BANK, (UINT8*)&data_info, sizeof(data_info));
+	raydium_i2c_batch_read(&batch, RM_CMD_QUERY_BANK, (UINT8*)&queryBankAddr, sizeof(queryBankAddr));
+	raydium_i2c_batch_read_indirect(&batch, &queryBankAddr, (UINT8*)&pDevice->info, sizeof(pDevice->info));
+
+	status = raydium_i2c_batch_execute(pDevice, &batch);
+	if (!NT_SUCCESS(status))
+		return status;
 
-		pDevice->packageSize = data_info.pkg_size;
-		pDevice->reportSize = pDevice->packageSize - RM_PACKET_CRC_SIZE;
-		pDevice->contactSize = data_info.tp_info_size;
-		pDevice->dataBankAddr = data_info.data_bank_addr;
+	pDevice->packageSize = data_info.pkg_size;
+	pDevice->reportSize = pDevice->packageSize - RM_PACKET_CRC_SIZE;
+	pDevice->contactSize = data_info.tp_info_size;
+	pDevice->dataBankAddr = data_info.data_bank_addr;
 
-		status = raydium_i2c_read(pDevice, RM_CMD_QUERY_BANK, (UINT8*)&queryBankAddr, sizeof(queryBankAddr));
-		if (!NT_SUCCESS(status))
-			continue;
+	status = raydium_select_decoder(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
 
-		status = raydium_i2c_read(pDevice, queryBankAddr, (UINT8*)&pDevice->info, sizeof(pDevice->info));
-		if (!NT_SUCCESS(status))
-			continue;
+	DbgPrint("Raydium Touch Screen Initialized (%d x %d)\n", pDevice->info.x_max, pDevice->info.y_max);
 
-		DbgPrint("Raydium Touch Screen Initialized (%d x %d)\n", pDevice->info.x_max, pDevice->info.y_max);
+	pDevice->max_x_hid[0] = pDevice->info.x_max & 0xFF;
+	pDevice->max_x_hid[1] = pDevice->info.x_max >> 8;
 
-		pDevice->max_x_hid[0] = pDevice->info.x_max & 0xFF;
-		pDevice->max_x_hid[1] = pDevice->info.x_max >> 8;
+	pDevice->max_y_hid[0] = pDevice->info.y_max & 0xFF;
+	pDevice->max_y_hid[1] = pDevice->info.y_max >> 8;
 
-		pDevice->max_y_hid[0] = pDevice->info.y_max & 0xFF;
-		pDevice->max_y_hid[1] = pDevice->info.y_max >> 8;
-		break;
-	}
 	return status;
 }
 
-static NTSTATUS raydium_i2c_check_fw_status(PRAYD_CONTEXT pDevice) {
-	static const UINT8 bl_ack = 0x62;
-	static const UINT8 main_ack = 0x66;
-	UINT8 buf[4];
-	NTSTATUS status;
-
-	status = raydium_i2c_read(pDevice, RM_CMD_BOOT_READ, buf, sizeof(buf));
-	if (NT_SUCCESS(status)) {
-		if (buf[0] == bl_ack)
-			pDevice->bootMode = RAYDIUM_TS_BLDR;
-		else if (buf[0] == main_ack)
-			pDevice->bootMode = RAYDIUM_TS_MAIN;
-		return status;
+static void raydium_free_frame_buffers(PRAYD_CONTEXT pDevice) {
+	for (int i = 0; i < RAYD_FRAME_BUFFERS; i++) {
+		if (pDevice->reportData[i]) {
+			ExFreePoolWithTag(pDevice->reportData[i], RAYD_POOL_TAG);
+			pDevice->reportData[i] = NULL;
+		}
 	}
-	return status;
+
+	pDevice->reportDataSize = 0;
+}
+
+//
+// hidclass parses the report descriptor once, when the device starts. A
+// re-query that moves the panel range or the contact capacity leaves it
+// holding a descriptor that no longer matches our reports.
+//
+static BOOLEAN raydium_report_layout_changed(PRAYD_CONTEXT pDevice) {
+	return pDevice->ReportDescriptor &&
+		(pDevice->DescriptorMaxX != pDevice->info.x_max ||
+		pDevice->DescriptorMaxY != pDevice->info.y_max ||
+		pDevice->DescriptorContacts != pDevice->ContactCapacity);
 }
 
 NTSTATUS BOOTTOUCHSCREEN(
@@ -271,22 +835,17 @@ NTSTATUS BOOTTOUCHSCREEN(
 	int retryCount;
 	for (retryCount = 0; retryCount < RM_MAX_RETRIES; retryCount++) {
 		/* Wait for Hello packet */
-		LARGE_INTEGER Interval;
-		Interval.QuadPart = -10 * 1000 * RM_BOOT_DELAY_MS;
-		KeDelayExecutionThread(KernelMode, FALSE, &Interval);
-
-		status = raydium_i2c_check_fw_status(devContext);
+		status = raydium_i2c_wait_ready(devContext, RM_BOOT_DELAY_MS, &devContext->BootReadyUs);
 		if (!NT_SUCCESS(status)) {
 			RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "failed to read 'hello' packet: 0x%x\n", status);
 			continue;
 		}
 
-		if (devContext->bootMode == RAYDIUM_TS_BLDR ||
-			devContext->bootMode == RAYDIUM_TS_MAIN) {
-			break;
-		}
+		break;
 	}
 
+	RaydPrint(DEBUG_LEVEL_INFO, DBG_INIT, "Raydium ready %d us after reset, %d us at boot\n", devContext->ResetReadyUs, devContext->BootReadyUs);
+
 	if (!NT_SUCCESS(status))
 		devContext->bootMode = RAYDIUM_TS_BLDR;
 
@@ -295,9 +854,48 @@ NTSTATUS BOOTTOUCHSCREEN(
 		if (!NT_SUCCESS(status)) {
 			return status;
 		}
-		devContext->reportData = (UINT8 *)ExAllocatePool2(POOL_FLAG_NON_PAGED, devContext->packageSize, RAYD_POOL_TAG);
-		if (!devContext->reportData)
-			return STATUS_NO_MEMORY;
+
+		//
+		// Have PnP restart the stack so hidclass fetches the new
+		// descriptor, instead of sending reports it would misparse
+		//
+		if (raydium_report_layout_changed(devContext)) {
+			RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Report layout changed to %d contacts, restarting\n", devContext->ContactCapacity);
+			WdfDeviceSetFailed(devContext->FxDevice, WdfDeviceFailedAttemptRestart);
+			return STATUS_DEVICE_CONFIGURATION_ERROR;
+		}
+
+		status = RaydUpdateReportDescriptor(devContext);
+		if (!NT_SUCCESS(status)) {
+			return status;
+		}
+
+		//
+		// Size the transport buffers for a whole packet now so the
+		// interrupt path never has to allocate
+		//
+		status = SpbTargetReserveBuffers(&devContext->I2CContext, devContext->packageSize + 1);
+		if (!NT_SUCCESS(status)) {
+			return status;
+		}
+
+		//
+		// A re-query can report a different packet size than the one the
+		// frame buffers were sized for
+		//
+		if (devContext->reportDataSize != devContext->packageSize)
+			raydium_free_frame_buffers(devContext);
+
+		for (int i = 0; i < RAYD_FRAME_BUFFERS; i++) {
+			if (!devContext->reportData[i]) {
+				devContext->reportData[i] = (UINT8*)ExAllocatePool2(POOL_FLAG_NON_PAGED, devContext->packageSize, RAYD_POOL_TAG);
+				if (!devContext->reportData[i])
+					return STATUS_NO_MEMORY;
+			}
+		}
+		devContext->reportDataSize = devContext->packageSize;
+
+		raydium_probe_chunk_size(devContext);
 
 		devContext->TouchScreenBooted = true;
 		return status;
@@ -308,6 +906,39 @@ NTSTATUS BOOTTOUCHSCREEN(
 	}
 }
 
+static NTSTATUS raydium_i2c_enter_sleep(PRAYD_CONTEXT pDevice) {
+	static const UINT8 sleep_cmd[] = { 0x5A, 0xff, 0x00, 0x0f };
+
+	return raydium_i2c_send(pDevice, RM_CMD_ENTER_SLEEP, sleep_cmd, sizeof(sleep_cmd));
+}
+
+//
+// Checks that a controller reset out of sleep is running main firmware
+// with the data bank layout queried at boot, so the query can be skipped.
+// readyStatus is the result of the reset's hello poll.
+//
+static NTSTATUS raydium_i2c_verify_resume(PRAYD_CONTEXT pDevice, NTSTATUS readyStatus) {
+	struct raydium_data_info data_info;
+	NTSTATUS status;
+
+	if (!NT_SUCCESS(readyStatus))
+		return readyStatus;
+
+	if (pDevice->bootMode != RAYDIUM_TS_MAIN)
+		return STATUS_DEVICE_NOT_READY;
+
+	status = raydium_i2c_read(pDevice, RM_CMD_DATA_BANK, (UINT8*)&data_info, sizeof(data_info));
+	if (!NT_SUCCESS(status))
+		return status;
+
+	if (data_info.data_bank_addr != pDevice->dataBankAddr ||
+		data_info.pkg_size != pDevice->packageSize ||
+		data_info.tp_info_size != pDevice->contactSize)
+		return STATUS_DEVICE_CONFIGURATION_ERROR;
+
+	return STATUS_SUCCESS;
+}
+
 NTSTATUS
 OnPrepareHardware(
 	_In_  WDFDEVICE     FxDevice,
@@ -431,10 +1062,16 @@ Status
 
 	UNREFERENCED_PARAMETER(FxResourcesTranslated);
 
-	if (pDevice->reportData) {
-		ExFreePoolWithTag(pDevice->reportData, RAYD_POOL_TAG);
+	raydium_free_frame_buffers(pDevice);
+
+	if (pDevice->ReportDescriptor) {
+		ExFreePoolWithTag(pDevice->ReportDescriptor, RAYD_POOL_TAG);
+		pDevice->ReportDescriptor = NULL;
 	}
 
+	pDevice->TouchScreenBooted = false;
+	pDevice->ControllerAsleep = false;
+
 	SpbTargetDeinitialize(FxDevice, &pDevice->I2CContext);
 
 	return status;
@@ -466,16 +1103,44 @@ Status
 
 	PRAYD_CONTEXT pDevice = GetDeviceContext(FxDevice);
 	NTSTATUS status = STATUS_SUCCESS;
+	NTSTATUS readyStatus;
+	LONGLONG resumeStart = KeQueryPerformanceCounter(NULL).QuadPart;
+	BOOLEAN fastResume;
+
+	raydium_i2c_invalidate_bank(pDevice);
 
-	status = raydium_i2c_sw_reset(pDevice);
+	//
+	// The reset also takes the controller out of RM_CMD_ENTER_SLEEP and
+	// restarts scanning
+	//
+	status = raydium_i2c_sw_reset(pDevice, &readyStatus);
 	if (!NT_SUCCESS(status)) {
 		return status;
 	}
 
-	for (int i = 0; i < 20; i++) {
-		pDevice->Flags[i] = 0;
+	//
+	// A controller we put to sleep keeps its firmware, so the boot query
+	// can be skipped unless it no longer answers as the firmware we queried
+	//
+	if (pDevice->ControllerAsleep && pDevice->TouchScreenBooted) {
+		status = raydium_i2c_verify_resume(pDevice, readyStatus);
+		if (!NT_SUCCESS(status)) {
+			RaydPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "resume verification failed: 0x%x\n", status);
+			pDevice->TouchScreenBooted = false;
+		}
 	}
+	pDevice->ControllerAsleep = false;
 
+	//
+	// Fast unless BOOTTOUCHSCREEN below has to query the controller again
+	//
+	fastResume = pDevice->TouchScreenBooted;
+
+	pDevice->DownSlots = 0;
+	pDevice->ReleasedSlots = 0;
+	RtlZeroMemory(pDevice->Motion, sizeof(pDevice->Motion));
+
+	pDevice->FrameState = 0;
 	pDevice->RegsSet = false;
 	pDevice->ConnectInterrupt = true;
 
@@ -484,6 +1149,16 @@ Status
 		return status;
 	}
 
+	if (fastResume)
+		pDevice->FastResumes++;
+	else
+		pDevice->FullResumes++;
+
+	pDevice->LastResumeUs = (ULONG)((KeQueryPerformanceCounter(NULL).QuadPart - resumeStart) *
+		1000000 / pDevice->PerformanceFrequency);
+
+	RaydPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Raydium %s resume took %d us\n", fastResume ? "fast" : "full", pDevice->LastResumeUs);
+
 	RaydCompleteIdleIrp(pDevice);
 
 	return status;
@@ -505,71 +1180,518 @@ Arguments:
 FxDevice - a handle to the framework device object
 FxPreviousState - previous power state
 
-Return Value:
+Return Value:
+
+Status
+
+--*/
+{
+	UNREFERENCED_PARAMETER(FxPreviousState);
+
+	PRAYD_CONTEXT pDevice = GetDeviceContext(FxDevice);
+	NTSTATUS status;
+
+	pDevice->ConnectInterrupt = false;
+
+	//
+	// Sleep rather than leave the controller scanning, OnD0Entry can then
+	// skip the re-query if it comes back unchanged
+	//
+	if (pDevice->TouchScreenBooted) {
+		status = raydium_i2c_enter_sleep(pDevice);
+		pDevice->ControllerAsleep = NT_SUCCESS(status);
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static LONGLONG raydium_timestamp(void) {
+	return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+//
+// Latency histograms count frames per stage in power of two microsecond
+// buckets, bucket n holding [2^(n-1), 2^n) us. They are updated from the
+// ISR, the work item and read dispatch without a lock.
+//
+static void raydium_record_latency(PRAYD_CONTEXT pDevice, RAYD_LATENCY_STAGE stage, LONGLONG start, LONGLONG end) {
+	ULONGLONG us;
+	ULONG bucket = 0;
+
+	if (start == 0 || end < start)
+		return;
+
+	us = (ULONGLONG)(end - start) * 1000000 / pDevice->PerformanceFrequency;
+	if (us > 0) {
+		_BitScanReverse(&bucket, (ULONG)min(us, MAXULONG));
+		bucket = min(bucket + 1, RAYD_LATENCY_BUCKETS - 1);
+	}
+
+	InterlockedIncrement((volatile LONG*)&pDevice->Latency[stage][bucket]);
+}
+
+static void raydium_record_completion(PRAYD_CONTEXT pDevice, const RAYD_FRAME_TIMES* times) {
+	LONGLONG now = raydium_timestamp();
+
+	raydium_record_latency(pDevice, RaydLatencyComplete, times->Input, now);
+	raydium_record_latency(pDevice, RaydLatencyTotal, times->Isr, now);
+}
+
+static int raydium_count_contacts(PRAYD_CONTEXT pDevice) {
+	ULONG active = pDevice->DownSlots | pDevice->ReleasedSlots;
+	int count = 0;
+
+	while (active && count < (int)pDevice->ContactCapacity) {
+		active &= active - 1;
+		count++;
+	}
+
+	return count;
+}
+
+static int raydium_build_contacts(PRAYD_CONTEXT pDevice, TOUCH* touches) {
+	ULONG active = pDevice->DownSlots | pDevice->ReleasedSlots;
+	ULONG i;
+	int count = 0;
+
+	while (count < (int)pDevice->ContactCapacity && _BitScanForward(&i, active)) {
+		TOUCH* touch = &touches[count];
+		ULONG bit = 1UL << i;
+
+		active &= ~bit;
+
+		touch->ContactID = (BYTE)i;
+		touch->Height = pDevice->AREA[i];
+		touch->Width = pDevice->AREA[i];
+
+		touch->XValue = pDevice->ReportX[i];
+		touch->YValue = pDevice->ReportY[i];
+
+		if (pDevice->DownSlots & bit) {
+			touch->Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
+		}
+		else {
+			//
+			// The lift-off goes out once, then the slot is idle
+			//
+			touch->Status = MULTI_CONFIDENCE_BIT;
+			pDevice->ReleasedSlots &= ~bit;
+		}
+
+		count++;
+	}
+
+	return count;
+}
+
+//
+// Input reports carry ContactsPerReport touches followed by the contact
+// count. Frames with more contacts than that go out as several reports,
+// only the first of which carries the frame's contact count (hybrid mode).
+//
+static void raydium_pack_report(PRAYD_CONTEXT pDevice, PUCHAR buffer, const TOUCH* touches, int count, USHORT scanTime, BYTE contactCount) {
+	ULONG slots = pDevice->ContactsPerReport;
+	TOUCH* reportTouches = (TOUCH*)&buffer[1];
+	PUCHAR trailer = (PUCHAR)&reportTouches[slots];
+
+	buffer[0] = REPORTID_MTOUCH;
+
+	if (touches != reportTouches)
+		RtlCopyMemory(reportTouches, touches, count * sizeof(TOUCH));
+
+	//
+	// Unused slots go out to the HID stack too, don't leave stale data in them
+	//
+	RtlZeroMemory(&reportTouches[count], (slots - count) * sizeof(TOUCH));
+
+	trailer[0] = scanTime & 0xFF;
+	trailer[1] = scanTime >> 8;
+	trailer[2] = contactCount;
+}
+
+static void raydium_pack_frame(PRAYD_CONTEXT pDevice, PUCHAR buffer, const RAYD_TOUCH_FRAME* frame, ULONG offset) {
+	int count = (int)min(frame->ActualCount - offset, pDevice->ContactsPerReport);
+
+	raydium_pack_report(pDevice, buffer, &frame->Touch[offset], count,
+		frame->ScanTime, offset == 0 ? frame->ActualCount : 0);
+}
+
+static BOOLEAN raydium_touch_down(const TOUCH* touch) {
+	return (touch->Status & MULTI_TIPSWITCH_BIT) != 0;
+}
+
+//
+// Fold a report into the newest queued one when the ring is full. Contacts
+// still down take their latest position, and a lift-off already queued is
+// never overwritten. A contact that lifted and touched down again within
+// the merged frames loses the new tip-down here, it goes out with the
+// next report since its slot is still active.
+//
+static void raydium_merge_report(PRAYD_CONTEXT pDevice, RAYD_TOUCH_FRAME* tail, const RAYD_TOUCH_FRAME* report) {
+	BOOLEAN overflowed = false;
+
+	for (int i = 0; i < report->ActualCount; i++) {
+		const TOUCH* touch = &report->Touch[i];
+		int j;
+
+		for (j = 0; j < tail->ActualCount; j++) {
+			if (tail->Touch[j].ContactID == touch->ContactID)
+				break;
+		}
+
+		if (j == tail->ActualCount) {
+			if (tail->ActualCount >= pDevice->ContactCapacity) {
+				overflowed = true;
+				continue;
+			}
+			tail->ActualCount++;
+		}
+		else if (!raydium_touch_down(&tail->Touch[j])) {
+			if (raydium_touch_down(touch))
+				overflowed = true;
+			continue;
+		}
+
+		tail->Touch[j] = *touch;
+	}
+
+	tail->ScanTime = report->ScanTime;
+
+	pDevice->ReportsMerged++;
+	if (overflowed)
+		pDevice->ReportsOverflowed++;
+}
+
+C_ASSERT(RAYD_REPORT_RING_SIZE > 1);
+
+//
+// Queue a frame whose reports from offset onwards have not been sent yet.
+// Only a frame going into an empty ring can be partly sent, so with the
+// ring size above one the merge target is never a partly sent frame.
+//
+static void raydium_queue_report(PRAYD_CONTEXT pDevice, const RAYD_TOUCH_FRAME* report, ULONG offset, const RAYD_FRAME_TIMES* times) {
+	ULONG tail;
+
+	if (pDevice->ReportRingCount == 0)
+		pDevice->ReportRingOffset = offset;
+
+	if (pDevice->ReportRingCount == RAYD_REPORT_RING_SIZE) {
+		tail = (pDevice->ReportRingHead + RAYD_REPORT_RING_SIZE - 1) % RAYD_REPORT_RING_SIZE;
+		raydium_merge_report(pDevice, &pDevice->ReportRing[tail], report);
+		return;
+	}
+
+	tail = (pDevice->ReportRingHead + pDevice->ReportRingCount) % RAYD_REPORT_RING_SIZE;
+	pDevice->ReportRing[tail] = *report;
+	pDevice->ReportRingTimes[tail] = *times;
+	pDevice->ReportRingCount++;
+}
+
+static BOOLEAN raydium_dequeue_report(PRAYD_CONTEXT pDevice, RAYD_TOUCH_FRAME* report, ULONG* offset, RAYD_FRAME_TIMES* times) {
+	if (pDevice->ReportRingCount == 0)
+		return false;
+
+	*report = pDevice->ReportRing[pDevice->ReportRingHead];
+	*times = pDevice->ReportRingTimes[pDevice->ReportRingHead];
+	*offset = pDevice->ReportRingOffset;
+
+	pDevice->ReportRingOffset += pDevice->ContactsPerReport;
+	if (pDevice->ReportRingOffset >= report->ActualCount) {
+		pDevice->ReportRingHead = (pDevice->ReportRingHead + 1) % RAYD_REPORT_RING_SIZE;
+		pDevice->ReportRingCount--;
+		pDevice->ReportRingOffset = 0;
+	}
+
+	return true;
+}
+
+void RaydProcessInput(PRAYD_CONTEXT pDevice) {
+	WDFREQUEST reqRead = NULL;
+	PVOID pReadReport = NULL;
+	NTSTATUS status;
+	ULONG count;
+
+	pDevice->Times.Input = raydium_timestamp();
+	raydium_record_latency(pDevice, RaydLatencyInput, pDevice->Times.Decode, pDevice->Times.Input);
+
+	count = raydium_count_contacts(pDevice);
+	if (count == 0)
+		return;
+
+	//
+	// Contacts held still produce the same report every frame. Optionally
+	// skip those, but resend at the keep-alive interval so the OS doesn't
+	// consider the contacts stale. Tip-down and tip-up always change the
+	// frame so they are never skipped.
+	//
+	ULONGLONG now = KeQueryInterruptTime();
+
+	if (pDevice->SuppressIdleReports && !pDevice->FrameChanged &&
+		now - pDevice->LastReportTime < (ULONGLONG)pDevice->KeepAliveMs * 10 * 1000) {
+		pDevice->ReportsSuppressed++;
+		return;
+	}
+
+	pDevice->LastReportTime = now;
+
+	//
+	// Reports already queued go out first. Otherwise, with a read pending,
+	// build the report straight into its buffer instead of staging it.
+	// Checking the queue under ReportLock keeps a read arriving now from
+	// missing the report we are about to queue.
+	//
+	WdfSpinLockAcquire(pDevice->ReportLock);
+
+	if (pDevice->ReportRingCount == 0) {
+		status = WdfIoQueueRetrieveNextRequest(pDevice->ReportQueue, &reqRead);
+		if (!NT_SUCCESS(status))
+			reqRead = NULL;
+	}
+
+	if (reqRead && count <= pDevice->ContactsPerReport) {
+		WdfSpinLockRelease(pDevice->ReportLock);
+
+		status = WdfRequestRetrieveOutputBuffer(reqRead,
+			pDevice->ReportLength,
+			&pReadReport,
+			NULL);
+		if (NT_SUCCESS(status)) {
+			PUCHAR buffer = (PUCHAR)pReadReport;
+			TOUCH* touches = (TOUCH*)&buffer[1];
+
+			raydium_pack_report(pDevice, buffer, touches, raydium_build_contacts(pDevice, touches),
+				pDevice->ScanTime, (BYTE)count);
+			raydium_record_completion(pDevice, &pDevice->Times);
+			WdfRequestCompleteWithInformation(reqRead, status, pDevice->ReportLength);
+			return;
+		}
+
+		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+			"WdfRequestRetrieveOutputBuffer failed Status 0x%x\n", status);
+		WdfRequestComplete(reqRead, status);
+
+		WdfSpinLockAcquire(pDevice->ReportLock);
+
+		reqRead = NULL;
+		if (pDevice->ReportRingCount == 0 &&
+			!NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pDevice->ReportQueue, &reqRead)))
+			reqRead = NULL;
+	}
+
+	RAYD_TOUCH_FRAME report;
+	ULONG offset = 0;
+
+	report.ActualCount = (BYTE)raydium_build_contacts(pDevice, report.Touch);
+	report.ScanTime = pDevice->ScanTime;
+
+	//
+	// Hand the frame's reports to pending reads for as long as there are
+	// any, and queue whatever is left
+	//
+	while (reqRead) {
+		WdfSpinLockRelease(pDevice->ReportLock);
+
+		status = WdfRequestRetrieveOutputBuffer(reqRead,
+			pDevice->ReportLength,
+			&pReadReport,
+			NULL);
+		if (NT_SUCCESS(status)) {
+			raydium_pack_frame(pDevice, (PUCHAR)pReadReport, &report, offset);
+			raydium_record_completion(pDevice, &pDevice->Times);
+			WdfRequestCompleteWithInformation(reqRead, status, pDevice->ReportLength);
+
+			offset += pDevice->ContactsPerReport;
+			if (offset >= report.ActualCount)
+				return;
+		}
+		else {
+			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+				"WdfRequestRetrieveOutputBuffer failed Status 0x%x\n", status);
+			WdfRequestComplete(reqRead, status);
+		}
+
+		WdfSpinLockAcquire(pDevice->ReportLock);
+
+		if (!NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pDevice->ReportQueue, &reqRead)))
+			reqRead = NULL;
+	}
+
+	raydium_queue_report(pDevice, &report, offset, &pDevice->Times);
+
+	WdfSpinLockRelease(pDevice->ReportLock);
+}
+
+//
+// FrameState packs the buffer index holding an unprocessed frame (bits 0-1)
+// and the buffer index being decoded by the work item (bits 2-3). Each is
+// stored as index + 1 so that zero means no buffer.
+//
+#define FRAME_PENDING(state)		((LONG)((state) & 3) - 1)
+#define FRAME_ACTIVE(state)			((LONG)(((state) >> 2) & 3) - 1)
+#define FRAME_STATE(pending, active)	(((pending) + 1) | (((active) + 1) << 2))
+
+static LONG raydium_claim_read_buffer(PRAYD_CONTEXT pDevice) {
+	for (;;) {
+		LONG state = pDevice->FrameState;
+		LONG pending = FRAME_PENDING(state);
+		LONG active = FRAME_ACTIVE(state);
+
+		if (pending < 0 || active < 0) {
+			return (pending == 0 || active == 0) ? 1 : 0;
+		}
+
+		//
+		// The work item is still decoding one buffer and the other holds a
+		// frame it has not picked up yet. Take that one back, the frame we
+		// are about to read supersedes it.
+		//
+		if (InterlockedCompareExchange(&pDevice->FrameState, FRAME_STATE(-1, active), state) == state) {
+			pDevice->FramesSuperseded++;
+			return pending;
+		}
+	}
+}
+
+static void raydium_publish_frame(PRAYD_CONTEXT pDevice, LONG index) {
+	for (;;) {
+		LONG state = pDevice->FrameState;
+
+		if (InterlockedCompareExchange(&pDevice->FrameState, FRAME_STATE(index, FRAME_ACTIVE(state)), state) == state) {
+			if (FRAME_PENDING(state) >= 0)
+				pDevice->FramesSuperseded++;
+			return;
+		}
+	}
+}
+
+static LONG raydium_take_frame(PRAYD_CONTEXT pDevice) {
+	for (;;) {
+		LONG state = pDevice->FrameState;
+		LONG pending = FRAME_PENDING(state);
+
+		if (pending < 0)
+			return -1;
+
+		if (InterlockedCompareExchange(&pDevice->FrameState, FRAME_STATE(-1, pending), state) == state)
+			return pending;
+	}
+}
+
+static void raydium_release_frame(PRAYD_CONTEXT pDevice) {
+	for (;;) {
+		LONG state = pDevice->FrameState;
+
+		if (InterlockedCompareExchange(&pDevice->FrameState, FRAME_STATE(FRAME_PENDING(state), -1), state) == state)
+			return;
+	}
+}
+
+static USHORT raydium_scan_time(PRAYD_CONTEXT pDevice, LONGLONG frameTime) {
+	LONGLONG frequency = pDevice->PerformanceFrequency;
+
+	//
+	// Scan Time counts in 100us units and wraps at 16 bits. Split the
+	// conversion so the multiply can't overflow on long uptimes.
+	//
+	return (USHORT)((frameTime / frequency) * 10000 +
+		(frameTime % frequency) * 10000 / frequency);
+}
+
+static LONG raydium_extrapolate(LONG position, LONG velocity, LONG accel, LONG ms, LONG limit) {
+	//
+	// p + v*t + a*t^2/2 with v and a in RAYD_MOTION_SHIFT fixed point
+	//
+	LONGLONG offset = (LONGLONG)velocity * ms + (LONGLONG)accel * ms * ms / 2;
+
+	position += (LONG)(offset >> RAYD_MOTION_SHIFT);
+
+	return max(0, min(position, limit));
+}
 
-Status
+static void raydium_update_motion(PRAYD_CONTEXT pDevice, ULONG slot, LONGLONG frameTime) {
+	PRAYD_CONTACT_MOTION motion = &pDevice->Motion[slot];
+	LONG x = pDevice->XValue[slot];
+	LONG y = pDevice->YValue[slot];
+	LONGLONG dt;
 
---*/
-{
-	UNREFERENCED_PARAMETER(FxPreviousState);
+	//
+	// dt in milliseconds, RAYD_MOTION_SHIFT fixed point
+	//
+	dt = (frameTime - motion->Time) * 1000 * (1 << RAYD_MOTION_SHIFT) / pDevice->PerformanceFrequency;
 
-	PRAYD_CONTEXT pDevice = GetDeviceContext(FxDevice);
+	if (motion->Samples > 0 && dt > 0) {
+		LONG vx = (LONG)(((LONGLONG)(x - motion->X) << (2 * RAYD_MOTION_SHIFT)) / dt);
+		LONG vy = (LONG)(((LONGLONG)(y - motion->Y) << (2 * RAYD_MOTION_SHIFT)) / dt);
 
-	pDevice->ConnectInterrupt = false;
+		if (motion->Samples > 1) {
+			motion->AccelX = (LONG)(((LONGLONG)(vx - motion->VelocityX) << RAYD_MOTION_SHIFT) / dt);
+			motion->AccelY = (LONG)(((LONGLONG)(vy - motion->VelocityY) << RAYD_MOTION_SHIFT) / dt);
+		}
 
-	return STATUS_SUCCESS;
-}
+		motion->VelocityX = vx;
+		motion->VelocityY = vy;
+		motion->Samples = (UINT8)min(motion->Samples + 1, 3);
+	}
+	else if (motion->Samples == 0) {
+		motion->VelocityX = motion->VelocityY = 0;
+		motion->AccelX = motion->AccelY = 0;
+		motion->Samples = 1;
+	}
 
-void RaydProcessInput(PRAYD_CONTEXT pDevice) {
-	struct _RAYD_MULTITOUCH_REPORT report;
-	report.ReportID = REPORTID_MTOUCH;
-
-	int count = 0, i = 0;
-	while (count < 10 && i < 20) {
-		if (pDevice->Flags[i] != 0) {
-			report.Touch[count].ContactID = (BYTE)i;
-			report.Touch[count].Height = pDevice->AREA[i];
-			report.Touch[count].Width = pDevice->AREA[i];
-
-			report.Touch[count].XValue = pDevice->XValue[i];
-			report.Touch[count].YValue = pDevice->YValue[i];
-
-			uint8_t flags = pDevice->Flags[i];
-			if (flags & MXT_T9_DETECT) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
-			}
-			else if (flags & MXT_T9_PRESS) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
-			}
-			else if (flags & MXT_T9_RELEASE) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT;
-				pDevice->Flags[i] = 0;
-			}
-			else
-				report.Touch[count].Status = 0;
+	motion->X = x;
+	motion->Y = y;
+	motion->Time = frameTime;
+}
 
-			count++;
+//
+// Work out the positions to report. With PredictionMs set, contacts that
+// have been down for a couple of frames are extrapolated that far ahead
+// from their velocity and, once known, acceleration. Tip-down and tip-up
+// report the raw position, and the decoded positions are kept as the
+// motion history.
+//
+static void raydium_predict_contacts(PRAYD_CONTEXT pDevice, LONGLONG frameTime) {
+	ULONG active = pDevice->DownSlots | pDevice->ReleasedSlots;
+	LONG ms = pDevice->PredictionMs;
+	ULONG i;
+
+	while (_BitScanForward(&i, active)) {
+		PRAYD_CONTACT_MOTION motion = &pDevice->Motion[i];
+		ULONG bit = 1UL << i;
+
+		active &= ~bit;
+
+		pDevice->ReportX[i] = pDevice->XValue[i];
+		pDevice->ReportY[i] = pDevice->YValue[i];
+
+		if (!(pDevice->DownSlots & bit)) {
+			motion->Samples = 0;
+			continue;
 		}
-		i++;
-	}
 
-	report.ActualCount = (BYTE)count;
+		if (!ms)
+			continue;
+
+		raydium_update_motion(pDevice, i, frameTime);
+		if (motion->Samples < 2)
+			continue;
 
-	if (count > 0) {
-		size_t bytesWritten;
-		RaydProcessVendorReport(pDevice, &report, sizeof(report), &bytesWritten);
+		pDevice->ReportX[i] = (USHORT)raydium_extrapolate(motion->X, motion->VelocityX, motion->AccelX, ms, pDevice->info.x_max);
+		pDevice->ReportY[i] = (USHORT)raydium_extrapolate(motion->Y, motion->VelocityY, motion->AccelY, ms, pDevice->info.y_max);
 	}
 }
 
-static UINT16 raydium_calc_chksum(const UINT8* buf, UINT16 len)
-{
-	UINT16 checksum = 0;
-	UINT16 i;
+static void raydium_process_frame(PRAYD_CONTEXT pDevice, UINT8* reportData, const RAYD_FRAME_TIMES* times) {
+	pDevice->Times = *times;
+	pDevice->ScanTime = raydium_scan_time(pDevice, times->Isr);
+	pDevice->FrameChanged = false;
+	pDevice->DecodeFrame(pDevice, reportData);
+	raydium_predict_contacts(pDevice, times->Isr);
 
-	for (i = 0; i < len; i++)
-		checksum += buf[i];
+	pDevice->Times.Decode = raydium_timestamp();
+	raydium_record_latency(pDevice, RaydLatencyDecode, pDevice->Times.Read, pDevice->Times.Decode);
 
-	return checksum;
+	RaydProcessInput(pDevice);
 }
 
 BOOLEAN OnInterruptIsr(
@@ -580,8 +1702,15 @@ BOOLEAN OnInterruptIsr(
 	WDFDEVICE Device = WdfInterruptGetDevice(Interrupt);
 	PRAYD_CONTEXT pDevice = GetDeviceContext(Device);
 
-	UNREFERENCED_PARAMETER(pDevice);
 	NTSTATUS status;
+	LONG index;
+	LARGE_INTEGER frameTime;
+
+	//
+	// Stamp the frame before the bus read so the scan time doesn't pick
+	// up bus latency
+	//
+	frameTime = KeQueryPerformanceCounter(NULL);
 
 	if (!pDevice->ConnectInterrupt) {
 		return false;
@@ -592,46 +1721,154 @@ BOOLEAN OnInterruptIsr(
 		return false;
 	}
 
-	status = raydium_i2c_read(pDevice, pDevice->dataBankAddr, pDevice->reportData, pDevice->packageSize);
+	//
+	// The packet has to be read here to release the interrupt line, but
+	// decode and reporting run in the work item so the next frame can be
+	// read into the other buffer meanwhile.
+	//
+	index = raydium_claim_read_buffer(pDevice);
+	pDevice->FrameTimes[index].Isr = frameTime.QuadPart;
+
+	raydium_frame_read_begin(pDevice);
+
+	status = raydium_i2c_read_frame(pDevice, pDevice->reportData[index], pDevice->ReadChunkSize);
+
+	//
+	// A checksum mismatch is usually a read that raced the firmware
+	// updating the data bank, so it is worth one immediate re-read
+	//
+	if (NT_SUCCESS(status) &&
+		!raydium_check_frame(pDevice, pDevice->reportData[index])) {
+		pDevice->ChecksumRereads++;
+
+		status = raydium_i2c_read_frame(pDevice, pDevice->reportData[index], pDevice->ReadChunkSize);
+		if (NT_SUCCESS(status) &&
+			!raydium_check_frame(pDevice, pDevice->reportData[index])) {
+			status = STATUS_CRC_ERROR;
+		}
+	}
+
+	raydium_frame_read_end(pDevice);
+
+	raydium_track_chunk_size(pDevice, status);
+
 	if (!NT_SUCCESS(status)) {
+		pDevice->FramesLost++;
 		return true;
 	}
 
-	UINT16 fw_crc = *((UINT16 *)&pDevice->reportData[pDevice->reportSize]);
-	UINT16 calc_crc = raydium_calc_chksum(pDevice->reportData, pDevice->reportSize);
-	if (fw_crc != calc_crc) {
-		RaydPrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Invalid raydium crc %#04x vs %#04x\n", calc_crc, fw_crc);
-		return true;
+	pDevice->FrameTimes[index].Read = raydium_timestamp();
+	raydium_record_latency(pDevice, RaydLatencyRead, frameTime.QuadPart, pDevice->FrameTimes[index].Read);
+
+	raydium_publish_frame(pDevice, index);
+
+	WdfInterruptQueueWorkItemForIsr(Interrupt);
+
+	return true;
+}
+
+VOID OnInterruptWorkItem(
+	WDFINTERRUPT Interrupt,
+	WDFOBJECT AssociatedObject) {
+	UNREFERENCED_PARAMETER(AssociatedObject);
+
+	WDFDEVICE Device = WdfInterruptGetDevice(Interrupt);
+	PRAYD_CONTEXT pDevice = GetDeviceContext(Device);
+	LONG index;
+
+	while ((index = raydium_take_frame(pDevice)) >= 0) {
+		raydium_process_frame(pDevice, pDevice->reportData[index], &pDevice->FrameTimes[index]);
+
+		raydium_release_frame(pDevice);
 	}
+}
 
-	for (int i = 0; i < pDevice->reportSize / pDevice->contactSize; i++) {
-		UINT8* contact = &pDevice->reportData[pDevice->contactSize * i];
-		bool state = contact[RM_CONTACT_STATE_POS];
-		UINT8 wx, wy;
+static VOID RaydQuerySetting(
+	IN WDFKEY Key,
+	IN PCWSTR Name,
+	OUT PULONG Value
+)
+{
+	UNICODE_STRING valueName;
+	ULONG value;
 
-		if (!state && pDevice->Flags[i] == MXT_T9_DETECT) {
-			pDevice->Flags[i] = MXT_T9_RELEASE;
-		} else if (state) {
-			pDevice->Flags[i] = MXT_T9_DETECT;
-		} else {
-			pDevice->Flags[i] = 0;
-		}
+	RtlInitUnicodeString(&valueName, Name);
 
-		if (!state)
-			continue;
+	if (NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value))) {
+		*Value = value;
+	}
+}
+
+static VOID RaydReadSettings(
+	IN PRAYD_CONTEXT pDevice
+)
+/*++
+
+Routine Description:
 
-		wx = contact[RM_CONTACT_WIDTH_X_POS];
-		wy = contact[RM_CONTACT_WIDTH_Y_POS];
+Loads the tunables from the device's Settings registry key,
+keeping the built in defaults for anything that is not set.
+
+Arguments:
+
+pDevice - a pointer to the device context
+
+Return Value:
+
+None
+
+--*/
+{
+	NTSTATUS status;
+	WDFKEY deviceKey;
+	WDFKEY settingsKey;
+	DECLARE_CONST_UNICODE_STRING(settingsName, L"Settings");
+
+	pDevice->RetryPolicy.MaxTries = RM_MAX_RETRIES;
+	pDevice->RetryPolicy.BaseDelayMs = RM_RETRY_BASE_DELAY_MS;
+	pDevice->RetryPolicy.MaxDelayMs = RM_RETRY_DELAY_MS;
+	pDevice->RetrySeed = KeQueryPerformanceCounter(NULL).LowPart;
+	pDevice->SuppressIdleReports = 0;
+	pDevice->KeepAliveMs = RAYD_KEEPALIVE_MS;
+	pDevice->ContactCapacity = MULTI_MAX_COUNT;
+	pDevice->ContactsPerReportSetting = 0;
+	pDevice->PredictionMs = 0;
+
+	status = WdfDeviceOpenRegistryKey(pDevice->FxDevice,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&deviceKey);
+	if (!NT_SUCCESS(status)) {
+		return;
+	}
 
-		pDevice->XValue[i] = *((UINT16*)&contact[RM_CONTACT_X_POS]);
-		pDevice->YValue[i] = *((UINT16*)&contact[RM_CONTACT_Y_POS]);
+	status = WdfRegistryOpenKey(deviceKey,
+		&settingsName,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&settingsKey);
+	if (NT_SUCCESS(status)) {
+		RaydQuerySetting(settingsKey, L"RetryCount", &pDevice->RetryPolicy.MaxTries);
+		RaydQuerySetting(settingsKey, L"RetryBaseDelayMs", &pDevice->RetryPolicy.BaseDelayMs);
+		RaydQuerySetting(settingsKey, L"RetryMaxDelayMs", &pDevice->RetryPolicy.MaxDelayMs);
+		RaydQuerySetting(settingsKey, L"SuppressIdleReports", &pDevice->SuppressIdleReports);
+		RaydQuerySetting(settingsKey, L"KeepAliveMs", &pDevice->KeepAliveMs);
+		RaydQuerySetting(settingsKey, L"ContactsPerReport", &pDevice->ContactsPerReportSetting);
+		RaydQuerySetting(settingsKey, L"PredictionMs", &pDevice->PredictionMs);
 
-		pDevice->AREA[i] = max(wx, wy);
+		WdfRegistryClose(settingsKey);
 	}
 
-	RaydProcessInput(pDevice);
+	WdfRegistryClose(deviceKey);
 
-	return true;
+	if (pDevice->RetryPolicy.MaxTries == 0)
+		pDevice->RetryPolicy.MaxTries = 1;
+
+	if (pDevice->PredictionMs > RAYD_MAX_PREDICTION_MS)
+		pDevice->PredictionMs = RAYD_MAX_PREDICTION_MS;
+
+	raydium_set_report_layout(pDevice);
 }
 
 NTSTATUS
@@ -647,6 +1884,7 @@ RaydEvtDeviceAdd(
 	WDF_INTERRUPT_CONFIG interruptConfig;
 	WDFQUEUE                      queue;
 	PRAYD_CONTEXT               devContext;
+	LARGE_INTEGER                 frequency;
 
 	UNREFERENCED_PARAMETER(Driver);
 
@@ -725,6 +1963,26 @@ RaydEvtDeviceAdd(
 
 	devContext->FxDevice = device;
 
+	KeInitializeEvent(&devContext->FrameReadIdle, NotificationEvent, TRUE);
+
+	KeQueryPerformanceCounter(&frequency);
+	devContext->PerformanceFrequency = frequency.QuadPart;
+
+	RaydReadSettings(devContext);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = device;
+
+	status = WdfSpinLockCreate(&attributes, &devContext->ReportLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		RaydPrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+			"WdfSpinLockCreate failed 0x%x\n", status);
+
+		return status;
+	}
+
 	WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
 
 	queueConfig.PowerManaged = WdfFalse;
@@ -773,6 +2031,7 @@ RaydEvtDeviceAdd(
 		OnInterruptIsr,
 		NULL);
 	interruptConfig.PassiveHandling = TRUE;
+	interruptConfig.EvtInterruptWorkItem = OnInterruptWorkItem;
 
 	status = WdfInterruptCreate(
 		device,
@@ -1185,6 +2444,99 @@ RaydEvtInternalDeviceControl(
 	return;
 }
 
+ULONG
+RaydBuildReportDescriptor(
+	IN PRAYD_CONTEXT DevContext,
+	OUT PHID_REPORT_DESCRIPTOR Buffer
+)
+/*++
+
+Routine Description:
+
+Generates the multitouch report descriptor with one logical collection
+per contact slot in an input report, the panel's coordinate range and
+the panel's contact capacity.
+Buffer may be NULL to only compute the length.
+
+Arguments:
+
+DevContext - a pointer to the device context
+Buffer - receives the descriptor
+
+Return Value:
+
+Length of the descriptor in bytes
+
+--*/
+{
+	RAYD_DESCRIPTOR_LAYOUT layout;
+
+	layout.Contacts = DevContext->ContactsPerReport;
+	layout.Usages = RAYD_REPORT_USAGES;
+	layout.XMax = DevContext->info.x_max;
+	layout.YMax = DevContext->info.y_max;
+	layout.MaxCount = (UCHAR)DevContext->ContactCapacity;
+
+	return RaydWriteReportDescriptor(Buffer, layout);
+}
+
+NTSTATUS
+RaydUpdateReportDescriptor(
+	IN PRAYD_CONTEXT DevContext
+)
+/*++
+
+Routine Description:
+
+Generates the report descriptor into the device context, keeping the
+cached one if the panel geometry and contact capacity it was built for
+have not changed.
+
+Arguments:
+
+DevContext - a pointer to the device context
+
+Return Value:
+
+Status
+
+--*/
+{
+	PHID_REPORT_DESCRIPTOR descriptor;
+	ULONG length;
+
+	if (DevContext->ReportDescriptor &&
+		DevContext->DescriptorMaxX == DevContext->info.x_max &&
+		DevContext->DescriptorMaxY == DevContext->info.y_max &&
+		DevContext->DescriptorContacts == DevContext->ContactCapacity)
+	{
+		return STATUS_SUCCESS;
+	}
+
+	length = RaydBuildReportDescriptor(DevContext, NULL);
+
+	descriptor = (PHID_REPORT_DESCRIPTOR)ExAllocatePool2(POOL_FLAG_NON_PAGED, length, RAYD_POOL_TAG);
+	if (!descriptor)
+	{
+		return STATUS_NO_MEMORY;
+	}
+
+	RaydBuildReportDescriptor(DevContext, descriptor);
+
+	if (DevContext->ReportDescriptor)
+	{
+		ExFreePoolWithTag(DevContext->ReportDescriptor, RAYD_POOL_TAG);
+	}
+
+	DevContext->ReportDescriptor = descriptor;
+	DevContext->ReportDescriptorLength = (USHORT)length;
+	DevContext->DescriptorMaxX = DevContext->info.x_max;
+	DevContext->DescriptorMaxY = DevContext->info.y_max;
+	DevContext->DescriptorContacts = DevContext->ContactCapacity;
+
+	return STATUS_SUCCESS;
+}
+
 NTSTATUS
 RaydGetHidDescriptor(
 	IN WDFDEVICE Device,
@@ -1194,8 +2546,9 @@ RaydGetHidDescriptor(
 	NTSTATUS            status = STATUS_SUCCESS;
 	size_t              bytesToCopy = 0;
 	WDFMEMORY           memory;
+	HID_DESCRIPTOR      hidDescriptor;
 
-	UNREFERENCED_PARAMETER(Device);
+	PRAYD_CONTEXT devContext = GetDeviceContext(Device);
 
 	RaydPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
 		"RaydGetHidDescriptor Entry\n");
@@ -1219,10 +2572,21 @@ RaydGetHidDescriptor(
 		return status;
 	}
 
+	status = RaydUpdateReportDescriptor(devContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		return status;
+	}
+
 	//
-	// Use hardcoded "HID Descriptor" 
+	// Use hardcoded "HID Descriptor" with the length of the report
+	// descriptor we generated
 	//
-	bytesToCopy = DefaultHidDescriptor.bLength;
+	hidDescriptor = DefaultHidDescriptor;
+	hidDescriptor.DescriptorList[0].wReportLength = devContext->ReportDescriptorLength;
+
+	bytesToCopy = hidDescriptor.bLength;
 
 	if (bytesToCopy == 0)
 	{
@@ -1236,7 +2600,7 @@ RaydGetHidDescriptor(
 
 	status = WdfMemoryCopyFromBuffer(memory,
 		0, // Offset
-		(PVOID)&DefaultHidDescriptor,
+		(PVOID)&hidDescriptor,
 		bytesToCopy);
 
 	if (!NT_SUCCESS(status))
@@ -1275,36 +2639,6 @@ RaydGetReportDescriptor(
 	RaydPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
 		"RaydGetReportDescriptor Entry\n");
 
-#define MT_TOUCH_COLLECTION												\
-			MT_TOUCH_COLLECTION0 \
-			0x26, devContext->max_x_hid[0], devContext->max_x_hid[1],                   /*       LOGICAL_MAXIMUM (WIDTH)    */ \
-			MT_TOUCH_COLLECTION1 \
-			0x26, devContext->max_y_hid[0], devContext->max_y_hid[1],                   /*       LOGICAL_MAXIMUM (HEIGHT)    */ \
-			MT_TOUCH_COLLECTION2 \
-
-	HID_REPORT_DESCRIPTOR ReportDescriptor[] = {
-		//
-		// Multitouch report starts here
-		//
-		0x05, 0x0d,                         // USAGE_PAGE (Digitizers)
-		0x09, 0x04,                         // USAGE (Touch Screen)
-		0xa1, 0x01,                         // COLLECTION (Application)
-		0x85, REPORTID_MTOUCH,              //   REPORT_ID (Touch)
-		0x09, 0x22,                         //   USAGE (Finger)
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		USAGE_PAGE
-		0xc0,                               // END_COLLECTION
-	};
-
 	//
 	// This IOCTL is METHOD_NEITHER so WdfRequestRetrieveOutputMemory
 	// will correctly retrieve buffer from Irp->UserBuffer. 
@@ -1324,23 +2658,30 @@ RaydGetReportDescriptor(
 	}
 
 	//
-	// Use hardcoded Report descriptor
+	// Use the report descriptor generated for the panel geometry
 	//
-	bytesToCopy = DefaultHidDescriptor.DescriptorList[0].wReportLength;
+	status = RaydUpdateReportDescriptor(devContext);
+
+	if (!NT_SUCCESS(status))
+	{
+		return status;
+	}
+
+	bytesToCopy = devContext->ReportDescriptorLength;
 
 	if (bytesToCopy == 0)
 	{
 		status = STATUS_INVALID_DEVICE_STATE;
 
 		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"DefaultHidDescriptor's reportLength is zero, 0x%x\n", status);
+			"Report descriptor length is zero, 0x%x\n", status);
 
 		return status;
 	}
 
 	status = WdfMemoryCopyFromBuffer(memory,
 		0,
-		(PVOID)ReportDescriptor,
+		(PVOID)devContext->ReportDescriptor,
 		bytesToCopy);
 	if (!NT_SUCCESS(status))
 	{
@@ -1553,108 +2894,65 @@ RaydWriteReport(
 }
 
 NTSTATUS
-RaydProcessVendorReport(
+RaydReadReport(
 	IN PRAYD_CONTEXT DevContext,
-	IN PVOID ReportBuffer,
-	IN ULONG ReportBufferLen,
-	OUT size_t* BytesWritten
+	IN WDFREQUEST Request,
+	OUT BOOLEAN* CompleteRequest
 )
 {
 	NTSTATUS status = STATUS_SUCCESS;
-	WDFREQUEST reqRead;
+	RAYD_TOUCH_FRAME report;
+	ULONG offset;
+	RAYD_FRAME_TIMES times;
 	PVOID pReadReport = NULL;
-	size_t bytesReturned = 0;
 
 	RaydPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
-		"RaydProcessVendorReport Entry\n");
-
-	status = WdfIoQueueRetrieveNextRequest(DevContext->ReportQueue,
-		&reqRead);
-
-	if (NT_SUCCESS(status))
-	{
-		status = WdfRequestRetrieveOutputBuffer(reqRead,
-			ReportBufferLen,
-			&pReadReport,
-			&bytesReturned);
-
-		if (NT_SUCCESS(status))
-		{
-			//
-			// Copy ReportBuffer into read request
-			//
-
-			if (bytesReturned > ReportBufferLen)
-			{
-				bytesReturned = ReportBufferLen;
-			}
-
-			RtlCopyMemory(pReadReport,
-				ReportBuffer,
-				bytesReturned);
-
-			//
-			// Complete read with the number of bytes returned as info
-			//
-
-			WdfRequestCompleteWithInformation(reqRead,
-				status,
-				bytesReturned);
-
-			RaydPrint(DEBUG_LEVEL_INFO, DBG_IOCTL,
-				"RaydProcessVendorReport %d bytes returned\n", bytesReturned);
-
-			//
-			// Return the number of bytes written for the write request completion
-			//
+		"RaydReadReport Entry\n");
 
-			*BytesWritten = bytesReturned;
+	//
+	// Validate the buffer before touching the ring, a queued report is
+	// only dequeued once there is somewhere to put it
+	//
+	status = WdfRequestRetrieveOutputBuffer(Request,
+		DevContext->ReportLength,
+		&pReadReport,
+		NULL);
 
-			RaydPrint(DEBUG_LEVEL_INFO, DBG_IOCTL,
-				"%s completed, Queue:0x%p, Request:0x%p\n",
-				DbgHidInternalIoctlString(IOCTL_HID_READ_REPORT),
-				DevContext->ReportQueue,
-				reqRead);
-		}
-		else
-		{
-			RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-				"WdfRequestRetrieveOutputBuffer failed Status 0x%x\n", status);
-		}
-	}
-	else
+	if (!NT_SUCCESS(status))
 	{
 		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"WdfIoQueueRetrieveNextRequest failed Status 0x%x\n", status);
+			"WdfRequestRetrieveOutputBuffer failed Status 0x%x\n", status);
+		return status;
 	}
 
-	RaydPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
-		"RaydProcessVendorReport Exit = 0x%x\n", status);
+	WdfSpinLockAcquire(DevContext->ReportLock);
 
-	return status;
-}
+	//
+	// Hand out a report queued while no read was pending
+	//
+	if (raydium_dequeue_report(DevContext, &report, &offset, &times))
+	{
+		WdfSpinLockRelease(DevContext->ReportLock);
 
-NTSTATUS
-RaydReadReport(
-	IN PRAYD_CONTEXT DevContext,
-	IN WDFREQUEST Request,
-	OUT BOOLEAN* CompleteRequest
-)
-{
-	NTSTATUS status = STATUS_SUCCESS;
+		raydium_pack_frame(DevContext, (PUCHAR)pReadReport, &report, offset);
+		raydium_record_completion(DevContext, &times);
+		WdfRequestSetInformation(Request, DevContext->ReportLength);
 
-	RaydPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
-		"RaydReadReport Entry\n");
+		return status;
+	}
 
 	//
 	// Forward this read request to our manual queue
 	// (in other words, we are going to defer this request
 	// until we have a corresponding write request to
-	// match it with)
+	// match it with). This stays under ReportLock so a
+	// report can't be queued between the check and here.
 	//
 
 	status = WdfRequestForwardToIoQueue(Request, DevContext->ReportQueue);
 
+	WdfSpinLockRelease(DevContext->ReportLock);
+
 	if (!NT_SUCCESS(status))
 	{
 		RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
@@ -1814,10 +3112,10 @@ RaydGetFeature(
 				{
 					pReport = (RaydMaxCountReport*)transferPacket->reportBuffer;
 
-					pReport->MaximumCount = MULTI_MAX_COUNT;
+					pReport->MaximumCount = (BYTE)DevContext->ContactCapacity;
 
 					RaydPrint(DEBUG_LEVEL_INFO, DBG_IOCTL,
-						"RaydGetFeature MaximumCount = 0x%x\n", MULTI_MAX_COUNT);
+						"RaydGetFeature MaximumCount = 0x%x\n", DevContext->ContactCapacity);
 				}
 				else
 				{
@@ -1832,6 +3130,33 @@ RaydGetFeature(
 				break;
 			}
 
+			case REPORTID_LATENCY:
+			{
+
+				RaydLatencyReport* pReport = NULL;
+
+				if (transferPacket->reportBufferLen == sizeof(RaydLatencyReport))
+				{
+					pReport = (RaydLatencyReport*)transferPacket->reportBuffer;
+
+					RtlCopyMemory(pReport->Histogram, DevContext->Latency, sizeof(pReport->Histogram));
+
+					RaydPrint(DEBUG_LEVEL_INFO, DBG_IOCTL,
+						"RaydGetFeature latency histograms\n");
+				}
+				else
+				{
+					status = STATUS_INVALID_PARAMETER;
+
+					RaydPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+						"RaydGetFeature Error transferPacket->reportBufferLen (%d) is different from sizeof(RaydLatencyReport) (%d)\n",
+						transferPacket->reportBufferLen,
+						sizeof(RaydLatencyReport));
+				}
+
+				break;
+			}
+
 			case REPORTID_FEATURE:
 			{
 
@@ -67,12 +67,20 @@
 #define MT_TOUCH_COLLECTION2												\
     0x09, 0x31,                         /*       USAGE (Y)                  */ \
     0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x05, 0x0d,                         /*       USAGE PAGE (Digitizers)    */ \
+    0x05, 0x0d,                         /*       USAGE PAGE (Digitizers)    */ 
+
+#define MT_TOUCH_WIDTH														\
     0x09, 0x48,                         /*       USAGE (Width)              */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
+    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ 
+
+#define MT_TOUCH_HEIGHT														\
     0x09, 0x49,                         /*       USAGE (Height)             */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0xc0,                               /*    END_COLLECTION                */
+    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ 
+
+#define MT_TOUCH_PRESSURE													\
+    0x26, 0xff, 0x00,                   /*       LOGICAL_MAXIMUM (255)      */ \
+    0x09, 0x30,                         /*       USAGE (Tip Pressure)       */ \
+    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ 
 
 #if 0
 0x26, 0x56, 0x05,                   /*       LOGICAL_MAXIMUM (1366)    */
@@ -85,6 +93,9 @@
 	MT_TOUCH_COLLECTION1 \
 	0x26, 0x00, 0x00,                   /*       LOGICAL_MAXIMUM (768)    */ \
 	MT_TOUCH_COLLECTION2 \
+	MT_TOUCH_WIDTH \
+	MT_TOUCH_HEIGHT \
+	0xc0,                               /*    END_COLLECTION                */ \
 
 #define USAGE_PAGE \
 	0x05, 0x0d,                         /*    USAGE_PAGE (Digitizers) */  \
@@ -92,11 +103,35 @@
 	0x95, 0x01,                         /*    REPORT_COUNT (1) */  \
 	0x75, 0x08,                         /*    REPORT_SIZE (8) */  \
 	0x15, 0x00,                         /*    LOGICAL_MINIMUM (0) */  \
-	0x25, 0x08,                         /*    LOGICAL_MAXIMUM (8) */  \
+	0x25, MULTI_MAX_COUNT,              /*    LOGICAL_MAXIMUM (contact capacity) */  \
 	0x81, 0x02,                         /*    INPUT (Data,Var,Abs) */  \
 	0x09, 0x55,                         /*    USAGE(Contact Count Maximum) */  \
 	0xb1, 0x02,                         /*    FEATURE (Data,Var,Abs) */  \
 
+#define SCAN_TIME \
+	0x55, 0x0C,                         /*    UNIT_EXPONENT (-4) */  \
+	0x66, 0x01, 0x10,                   /*    UNIT (Seconds) */  \
+	0x47, 0xff, 0xff, 0x00, 0x00,       /*    PHYSICAL_MAXIMUM (65535) */  \
+	0x27, 0xff, 0xff, 0x00, 0x00,       /*    LOGICAL_MAXIMUM (65535) */  \
+	0x75, 0x10,                         /*    REPORT_SIZE (16) */  \
+	0x95, 0x01,                         /*    REPORT_COUNT (1) */  \
+	0x05, 0x0d,                         /*    USAGE_PAGE (Digitizers) */  \
+	0x09, 0x56,                         /*    USAGE (Scan Time) */  \
+	0x81, 0x02,                         /*    INPUT (Data,Var,Abs) */  \
+
+#define LATENCY_COLLECTION \
+	0x06, 0x00, 0xff,                   /* USAGE_PAGE (Vendor Defined 0xFF00) */  \
+	0x09, 0x01,                         /* USAGE (Vendor Usage 1) */  \
+	0xa1, 0x01,                         /* COLLECTION (Application) */  \
+	0x85, REPORTID_LATENCY,             /*   REPORT_ID (Latency) */  \
+	0x09, 0x02,                         /*   USAGE (Vendor Usage 2) */  \
+	0x15, 0x00,                         /*   LOGICAL_MINIMUM (0) */  \
+	0x27, 0xff, 0xff, 0xff, 0x7f,       /*   LOGICAL_MAXIMUM (0x7fffffff) */  \
+	0x75, 0x20,                         /*   REPORT_SIZE (32) */  \
+	0x95, RAYD_LATENCY_STAGES * RAYD_LATENCY_BUCKETS, /*   REPORT_COUNT */  \
+	0xb1, 0x02,                         /*   FEATURE (Data,Var,Abs) */  \
+	0xc0,                               /* END_COLLECTION */  \
+
 									//
 									// This is the default report descriptor for the Hid device provided
 									// by the mini driver in response to IOCTL_HID_GET_REPORT_DESCRIPTOR.
@@ -105,7 +140,7 @@
 	typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
 
 #ifdef DESCRIPTOR_DEF
-HID_REPORT_DESCRIPTOR DefaultReportDescriptor[] = {
+constexpr HID_REPORT_DESCRIPTOR DefaultReportDescriptor[] = {
 	//
 	// Multitouch report starts here
 	//
@@ -124,8 +159,10 @@ HID_REPORT_DESCRIPTOR DefaultReportDescriptor[] = {
 	MT_REF_TOUCH_COLLECTION
 	MT_REF_TOUCH_COLLECTION
 	MT_REF_TOUCH_COLLECTION
+	SCAN_TIME
 	USAGE_PAGE
 	0xc0,                               // END_COLLECTION
+	LATENCY_COLLECTION
 };
 
 
@@ -144,14 +181,365 @@ CONST HID_DESCRIPTOR DefaultHidDescriptor = {
 	{ 0x22,   // descriptor type 
 	sizeof(DefaultReportDescriptor) }  // total length of report descriptor
 };
+
+//
+// The pieces the report descriptor is generated from. The logical maxima
+// in RaydTouchContact and RaydTouchFooter are patched with the panel range
+// and contact capacity.
+//
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchHeader[] = {
+	0x05, 0x0d,                         // USAGE_PAGE (Digitizers)
+	0x09, 0x04,                         // USAGE (Touch Screen)
+	0xa1, 0x01,                         // COLLECTION (Application)
+	0x85, REPORTID_MTOUCH,              //   REPORT_ID (Touch)
+	0x09, 0x22,                         //   USAGE (Finger)
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchContact[] = {
+	MT_TOUCH_COLLECTION0
+	0x26, 0x00, 0x00,                   //       LOGICAL_MAXIMUM (x_max)
+	MT_TOUCH_COLLECTION1
+	0x26, 0x00, 0x00,                   //       LOGICAL_MAXIMUM (y_max)
+	MT_TOUCH_COLLECTION2
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchWidth[] = {
+	MT_TOUCH_WIDTH
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchHeight[] = {
+	MT_TOUCH_HEIGHT
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchPressure[] = {
+	MT_TOUCH_PRESSURE
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchContactEnd[] = {
+	0xc0,                               //    END_COLLECTION
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchScanTime[] = {
+	SCAN_TIME
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydTouchFooter[] = {
+	USAGE_PAGE
+	0xc0,                               // END_COLLECTION
+};
+
+constexpr HID_REPORT_DESCRIPTOR RaydLatencyCollection[] = {
+	LATENCY_COLLECTION
+};
+
+#define HID_ITEM_REPORT_ID			0x84
+#define HID_ITEM_REPORT_SIZE		0x74
+#define HID_ITEM_REPORT_COUNT		0x94
+#define HID_ITEM_INPUT				0x80
+#define HID_ITEM_FEATURE			0xb0
+
+constexpr ULONG RaydItemSize(HID_REPORT_DESCRIPTOR Prefix)
+{
+	return (Prefix & 3) == 3 ? 4 : (Prefix & 3);
+}
+
+constexpr ULONG RaydItemValue(const HID_REPORT_DESCRIPTOR* Item)
+{
+	ULONG value = 0;
+
+	for (ULONG i = RaydItemSize(Item[0]); i > 0; i--)
+		value = (value << 8) | Item[i];
+
+	return value;
+}
+
+//
+// Offset of the Index'th item with the given prefix byte, or Length
+// if there is none
+//
+constexpr ULONG RaydFindItem(const HID_REPORT_DESCRIPTOR* Descriptor, ULONG Length, HID_REPORT_DESCRIPTOR Prefix, ULONG Index)
+{
+	for (ULONG offset = 0; offset < Length; offset += 1 + RaydItemSize(Descriptor[offset])) {
+		if (Descriptor[offset] == Prefix && Index-- == 0)
+			return offset;
+	}
+
+	return Length;
+}
+
+//
+// Number of bits the descriptor declares for the given report and main
+// item type (input or feature). Report ID 0 counts items declared before
+// any REPORT_ID, so descriptor pieces can be measured on their own.
+//
+constexpr ULONG RaydReportBits(const HID_REPORT_DESCRIPTOR* Descriptor, ULONG Length, HID_REPORT_DESCRIPTOR MainItem, ULONG ReportId)
+{
+	ULONG reportId = 0, reportSize = 0, reportCount = 0, bits = 0;
+
+	for (ULONG offset = 0; offset < Length; offset += 1 + RaydItemSize(Descriptor[offset])) {
+		HID_REPORT_DESCRIPTOR tag = (HID_REPORT_DESCRIPTOR)(Descriptor[offset] & 0xfc);
+		ULONG value = RaydItemValue(&Descriptor[offset]);
+
+		if (tag == HID_ITEM_REPORT_ID)
+			reportId = value;
+		else if (tag == HID_ITEM_REPORT_SIZE)
+			reportSize = value;
+		else if (tag == HID_ITEM_REPORT_COUNT)
+			reportCount = value;
+		else if (tag == MainItem && reportId == ReportId)
+			bits += reportSize * reportCount;
+	}
+
+	return bits;
+}
+
+constexpr ULONG RaydContactXMaxOffset = RaydFindItem(RaydTouchContact, sizeof(RaydTouchContact), 0x26, 0) + 1;
+constexpr ULONG RaydContactYMaxOffset = RaydFindItem(RaydTouchContact, sizeof(RaydTouchContact), 0x26, 1) + 1;
+constexpr ULONG RaydContactCountMaxOffset = RaydFindItem(RaydTouchFooter, sizeof(RaydTouchFooter), 0x25, 0) + 1;
+
+//
+// Optional usages in the touch report
+//
+#define RAYD_USAGE_SCAN_TIME	0x1
+#define RAYD_USAGE_WIDTH		0x2
+#define RAYD_USAGE_HEIGHT		0x4
+#define RAYD_USAGE_PRESSURE		0x8
+
+//
+// The usages the driver reports, matching TOUCH and RAYD_MULTITOUCH_REPORT
+//
+#define RAYD_REPORT_USAGES		(RAYD_USAGE_SCAN_TIME | RAYD_USAGE_WIDTH | RAYD_USAGE_HEIGHT)
+
+typedef struct _RAYD_DESCRIPTOR_LAYOUT
+{
+	ULONG Contacts;
+
+	ULONG Usages;
+
+	USHORT XMax;
+
+	USHORT YMax;
+
+	UCHAR MaxCount;
+
+} RAYD_DESCRIPTOR_LAYOUT;
+
+constexpr ULONG RaydAppendDescriptor(HID_REPORT_DESCRIPTOR* Buffer, ULONG Offset, const HID_REPORT_DESCRIPTOR* Items, ULONG Length)
+{
+	if (Buffer) {
+		for (ULONG i = 0; i < Length; i++)
+			Buffer[Offset + i] = Items[i];
+	}
+
+	return Offset + Length;
+}
+
+//
+// Writes the report descriptor for the given layout into Buffer and
+// returns its length. Buffer may be NULL to only compute the length.
+// This runs at compile time for the checks below and at runtime for the
+// descriptor handed to hidclass.
+//
+constexpr ULONG RaydWriteReportDescriptor(HID_REPORT_DESCRIPTOR* Buffer, RAYD_DESCRIPTOR_LAYOUT Layout)
+{
+	ULONG offset = RaydAppendDescriptor(Buffer, 0, RaydTouchHeader, sizeof(RaydTouchHeader));
+
+	for (ULONG i = 0; i < Layout.Contacts; i++) {
+		if (Buffer) {
+			RaydAppendDescriptor(Buffer, offset, RaydTouchContact, sizeof(RaydTouchContact));
+
+			Buffer[offset + RaydContactXMaxOffset] = (HID_REPORT_DESCRIPTOR)(Layout.XMax & 0xFF);
+			Buffer[offset + RaydContactXMaxOffset + 1] = (HID_REPORT_DESCRIPTOR)(Layout.XMax >> 8);
+			Buffer[offset + RaydContactYMaxOffset] = (HID_REPORT_DESCRIPTOR)(Layout.YMax & 0xFF);
+			Buffer[offset + RaydContactYMaxOffset + 1] = (HID_REPORT_DESCRIPTOR)(Layout.YMax >> 8);
+		}
+		offset += sizeof(RaydTouchContact);
+
+		if (Layout.Usages & RAYD_USAGE_WIDTH)
+			offset = RaydAppendDescriptor(Buffer, offset, RaydTouchWidth, sizeof(RaydTouchWidth));
+		if (Layout.Usages & RAYD_USAGE_HEIGHT)
+			offset = RaydAppendDescriptor(Buffer, offset, RaydTouchHeight, sizeof(RaydTouchHeight));
+		if (Layout.Usages & RAYD_USAGE_PRESSURE)
+			offset = RaydAppendDescriptor(Buffer, offset, RaydTouchPressure, sizeof(RaydTouchPressure));
+
+		offset = RaydAppendDescriptor(Buffer, offset, RaydTouchContactEnd, sizeof(RaydTouchContactEnd));
+	}
+
+	if (Layout.Usages & RAYD_USAGE_SCAN_TIME)
+		offset = RaydAppendDescriptor(Buffer, offset, RaydTouchScanTime, sizeof(RaydTouchScanTime));
+
+	if (Buffer) {
+		RaydAppendDescriptor(Buffer, offset, RaydTouchFooter, sizeof(RaydTouchFooter));
+		Buffer[offset + RaydContactCountMaxOffset] = Layout.MaxCount;
+	}
+	offset += sizeof(RaydTouchFooter);
+
+	return RaydAppendDescriptor(Buffer, offset, RaydLatencyCollection, sizeof(RaydLatencyCollection));
+}
+
+//
+// Report descriptor with its layout fixed at compile time
+//
+template <ULONG Contacts, ULONG Usages, USHORT XMax, USHORT YMax, UCHAR MaxCount>
+struct RaydReportDescriptorT
+{
+	static constexpr ULONG Length = RaydWriteReportDescriptor(nullptr, { Contacts, Usages, XMax, YMax, MaxCount });
+
+	HID_REPORT_DESCRIPTOR Bytes[Length];
+
+	constexpr RaydReportDescriptorT() : Bytes()
+	{
+		RaydWriteReportDescriptor(Bytes, { Contacts, Usages, XMax, YMax, MaxCount });
+	}
+};
+
+constexpr bool RaydDescriptorEqual(const HID_REPORT_DESCRIPTOR* A, const HID_REPORT_DESCRIPTOR* B, ULONG Length)
+{
+	for (ULONG i = 0; i < Length; i++) {
+		if (A[i] != B[i])
+			return false;
+	}
+
+	return true;
+}
+
+//
+// Check the generated descriptor against the report structures it
+// describes, for a full report and for a hybrid-mode report
+//
+static_assert(RaydContactYMaxOffset < sizeof(RaydTouchContact),
+	"contact collection is missing its logical maxima");
+static_assert(RaydContactCountMaxOffset < sizeof(RaydTouchFooter),
+	"contact count is missing its logical maximum");
+
+constexpr RaydReportDescriptorT<MULTI_MAX_COUNT, RAYD_REPORT_USAGES, 0, 0, MULTI_MAX_COUNT> RaydFullReportDescriptor;
+constexpr RaydReportDescriptorT<1, RAYD_REPORT_USAGES, 0, 0, MULTI_MAX_COUNT> RaydHybridReportDescriptor;
+
+static_assert(RaydFullReportDescriptor.Length == sizeof(DefaultReportDescriptor),
+	"generated descriptor length differs from DefaultReportDescriptor");
+static_assert(RaydDescriptorEqual(RaydFullReportDescriptor.Bytes, DefaultReportDescriptor, sizeof(DefaultReportDescriptor)),
+	"generated descriptor differs from DefaultReportDescriptor");
+static_assert(RaydReportBits(RaydFullReportDescriptor.Bytes, RaydFullReportDescriptor.Length, HID_ITEM_INPUT, REPORTID_MTOUCH) ==
+	(sizeof(RaydMultiTouchReport) - 1) * 8,
+	"touch input report does not match RAYD_MULTITOUCH_REPORT");
+static_assert(RaydReportBits(RaydHybridReportDescriptor.Bytes, RaydHybridReportDescriptor.Length, HID_ITEM_INPUT, REPORTID_MTOUCH) ==
+	(sizeof(RaydMultiTouchReport) - 1 - (MULTI_MAX_COUNT - 1) * sizeof(TOUCH)) * 8,
+	"hybrid touch input report does not match TOUCH");
+static_assert(RaydReportBits(RaydFullReportDescriptor.Bytes, RaydFullReportDescriptor.Length, HID_ITEM_FEATURE, REPORTID_MTOUCH) ==
+	(sizeof(RaydMaxCountReport) - 1) * 8,
+	"contact count maximum does not match RAYD_MAXCOUNT_REPORT");
+static_assert(RaydReportBits(RaydFullReportDescriptor.Bytes, RaydFullReportDescriptor.Length, HID_ITEM_FEATURE, REPORTID_LATENCY) ==
+	(sizeof(RaydLatencyReport) - 1) * 8,
+	"latency feature report does not match RAYD_LATENCY_REPORT");
 #endif
 
 #define true 1
 #define false 0
 
-#define MXT_T9_RELEASE		(1 << 5)
-#define MXT_T9_PRESS		(1 << 6)
-#define MXT_T9_DETECT		(1 << 7)
+#define RAYD_FRAME_BUFFERS	2
+
+#define RAYD_MAX_CONTACT_SLOTS	32
+
+C_ASSERT(RAYD_MAX_CONTACT_SLOTS <= 32);
+
+#define RAYD_REPORT_RING_SIZE	8
+
+#define RAYD_KEEPALIVE_MS		100
+
+#define RAYD_MAX_PREDICTION_MS	20
+#define RAYD_MOTION_SHIFT		8
+
+#define RM_RETRY_BASE_DELAY_MS	2
+
+#define RM_FRAME_LOCK_TIMEOUT_MS	5
+#define RM_CONTROL_LOCK_TIMEOUT_MS	100
+
+#define RM_PROBE_READ_SIZE		128
+#define RM_PROBE_READS			3
+#define RM_CHUNK_MAX_FAILURES	3
+
+#define RM_READY_POLL_MIN_MS	1
+#define RM_READY_POLL_MAX_MS	16
+
+typedef struct _RAYD_RETRY_POLICY
+{
+	ULONG MaxTries;
+
+	ULONG BaseDelayMs;
+
+	ULONG MaxDelayMs;
+
+} RAYD_RETRY_POLICY;
+
+typedef void (*PRAYD_DECODE_FRAME)(struct _RAYD_CONTEXT* pDevice, const UINT8* reportData);
+
+//
+// Touch pipeline stages timed into the latency histograms
+//
+typedef enum _RAYD_LATENCY_STAGE
+{
+	RaydLatencyRead,		// ISR entry to packet read
+	RaydLatencyDecode,		// packet read to decode done
+	RaydLatencyInput,		// decode done to report building
+	RaydLatencyComplete,	// report building to read completion
+	RaydLatencyTotal,		// ISR entry to read completion
+	RaydLatencyStages
+} RAYD_LATENCY_STAGE;
+
+C_ASSERT(RaydLatencyStages == RAYD_LATENCY_STAGES);
+
+//
+// Motion history of a contact for prediction. Velocity is in position
+// units per ms and acceleration in units per ms^2, both in
+// RAYD_MOTION_SHIFT fixed point.
+//
+typedef struct _RAYD_CONTACT_MOTION
+{
+	LONG X;
+
+	LONG Y;
+
+	LONG VelocityX;
+
+	LONG VelocityY;
+
+	LONG AccelX;
+
+	LONG AccelY;
+
+	LONGLONG Time;
+
+	UINT8 Samples;
+
+} RAYD_CONTACT_MOTION, *PRAYD_CONTACT_MOTION;
+
+//
+// A frame of contacts as queued for reporting. It holds up to the
+// firmware's slot count, and is split into input reports of
+// ContactsPerReport contacts when sent.
+//
+typedef struct _RAYD_TOUCH_FRAME
+{
+	TOUCH Touch[RAYD_MAX_CONTACT_SLOTS];
+
+	USHORT ScanTime;
+
+	BYTE ActualCount;
+
+} RAYD_TOUCH_FRAME;
+
+typedef struct _RAYD_FRAME_TIMES
+{
+	LONGLONG Isr;
+
+	LONGLONG Read;
+
+	LONGLONG Decode;
+
+	LONGLONG Input;
+
+} RAYD_FRAME_TIMES;
 
 typedef struct _RAYD_CONTEXT
 {
@@ -172,17 +560,37 @@ typedef struct _RAYD_CONTEXT
 
 	BOOLEAN TouchScreenBooted;
 
+	BOOLEAN ControllerAsleep;
+
 	BOOLEAN RegsSet;
 
 	UINT32 TouchCount;
 
-	uint8_t      Flags[20];
+	//
+	// Slot bitmaps, DownSlots for contacts touching and ReleasedSlots for
+	// lift-offs not reported yet
+	//
+	ULONG DownSlots;
+
+	ULONG ReleasedSlots;
+
+	USHORT    XValue[RAYD_MAX_CONTACT_SLOTS];
 
-	USHORT    XValue[20];
+	USHORT    YValue[RAYD_MAX_CONTACT_SLOTS];
 
-	USHORT    YValue[20];
+	USHORT    AREA[RAYD_MAX_CONTACT_SLOTS];
 
-	USHORT    AREA[20];
+	//
+	// Positions reported for each slot, predicted ahead when PredictionMs
+	// is set
+	//
+	USHORT    ReportX[RAYD_MAX_CONTACT_SLOTS];
+
+	USHORT    ReportY[RAYD_MAX_CONTACT_SLOTS];
+
+	RAYD_CONTACT_MOTION Motion[RAYD_MAX_CONTACT_SLOTS];
+
+	ULONG PredictionMs;
 
 	uint8_t max_x_hid[2];
 	uint8_t max_y_hid[2];
@@ -193,10 +601,114 @@ typedef struct _RAYD_CONTEXT
 	UINT8 reportSize;
 	UINT8 contactSize;
 	UINT8 packageSize;
+	UINT8 contactSlots;
+
+	//
+	// Packet decoder picked from the contact layout at query time
+	//
+	PRAYD_DECODE_FRAME DecodeFrame;
 
 	enum raydium_boot_mode bootMode;
 
-	UINT8* reportData;
+	//
+	// Packet buffers the ISR reads into while the interrupt work item
+	// decodes the other one. FrameState tracks which buffer holds an
+	// unprocessed frame and which one is being decoded.
+	//
+	UINT8* reportData[RAYD_FRAME_BUFFERS];
+	UINT32 reportDataSize;
+	volatile LONG FrameState;
+	ULONG FramesSuperseded;
+
+	//
+	// Pipeline timestamps for each packet buffer and for the frame being
+	// reported, its Scan Time, and the per stage latency histograms
+	//
+	RAYD_FRAME_TIMES FrameTimes[RAYD_FRAME_BUFFERS];
+	RAYD_FRAME_TIMES Times;
+	LONGLONG PerformanceFrequency;
+	USHORT ScanTime;
+	ULONG Latency[RAYD_LATENCY_STAGES][RAYD_LATENCY_BUCKETS];
+
+	RAYD_RETRY_POLICY RetryPolicy;
+	ULONG RetrySeed;
+	ULONG I2CRetries;
+	ULONG ChecksumRereads;
+	ULONG FramesLost;
+
+	//
+	// Bus arbitration, frame reads go ahead of control traffic
+	//
+	volatile LONG FrameReadsPending;
+	KEVENT FrameReadIdle;
+	ULONG FrameLockTimeouts;
+	ULONG ControlYields;
+	LONGLONG MaxFrameLockWait;
+
+	//
+	// Data bank read size picked at boot, falls back to RM_MAX_READ_SIZE
+	// when the larger size keeps failing
+	//
+	UINT32 ReadChunkSize;
+	ULONG ChunkFailures;
+	ULONG ChunkFallbacks;
+
+	//
+	// D0 entries that skipped the boot query versus those that ran it,
+	// and how long the last one took
+	//
+	ULONG FastResumes;
+	ULONG FullResumes;
+	ULONG LastResumeUs;
+
+	//
+	// Time the controller took to answer the hello packet after the last
+	// reset and at the last boot, and hello polls that hit their deadline
+	//
+	ULONG ResetReadyUs;
+	ULONG BootReadyUs;
+	ULONG ReadyTimeouts;
+
+	//
+	// Reports produced while no HID read was pending, drained by
+	// RaydReadReport. Once full, new reports merge into the newest entry.
+	//
+	WDFSPINLOCK ReportLock;
+	RAYD_TOUCH_FRAME ReportRing[RAYD_REPORT_RING_SIZE];
+	RAYD_FRAME_TIMES ReportRingTimes[RAYD_REPORT_RING_SIZE];
+	ULONG ReportRingHead;
+	ULONG ReportRingCount;
+	ULONG ReportRingOffset;
+	ULONG ReportsMerged;
+	ULONG ReportsOverflowed;
+
+	//
+	// Contacts the panel can report, taken from the firmware's slot count.
+	// Contact slots per input report, frames with more contacts are split
+	// across several reports. ReportLength is the resulting report size.
+	//
+	ULONG ContactCapacity;
+	ULONG ContactsPerReportSetting;
+	ULONG ContactsPerReport;
+	ULONG ReportLength;
+
+	//
+	// Report descriptor generated for the geometry below
+	//
+	PHID_REPORT_DESCRIPTOR ReportDescriptor;
+	USHORT ReportDescriptorLength;
+	UINT16 DescriptorMaxX;
+	UINT16 DescriptorMaxY;
+	ULONG DescriptorContacts;
+
+	//
+	// Optional suppression of reports identical to the last one sent
+	//
+	ULONG SuppressIdleReports;
+	ULONG KeepAliveMs;
+	BOOLEAN FrameChanged;
+	ULONGLONG LastReportTime;
+	ULONG ReportsSuppressed;
 
 } RAYD_CONTEXT, *PRAYD_CONTEXT;
 
@@ -232,6 +744,21 @@ EVT_WDFDEVICE_WDM_IRP_PREPROCESS RaydEvtWdmPreprocessMnQueryId;
 
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL RaydEvtInternalDeviceControl;
 
+EVT_WDF_INTERRUPT_ISR OnInterruptIsr;
+
+EVT_WDF_INTERRUPT_WORKITEM OnInterruptWorkItem;
+
+ULONG
+RaydBuildReportDescriptor(
+	IN PRAYD_CONTEXT DevContext,
+	OUT PHID_REPORT_DESCRIPTOR Buffer
+);
+
+NTSTATUS
+RaydUpdateReportDescriptor(
+	IN PRAYD_CONTEXT DevContext
+);
+
 NTSTATUS
 RaydGetHidDescriptor(
 	IN WDFDEVICE Device,
@@ -260,14 +787,6 @@ RaydWriteReport(
 	IN WDFREQUEST Request
 );
 
-NTSTATUS
-RaydProcessVendorReport(
-	IN PRAYD_CONTEXT DevContext,
-	IN PVOID ReportBuffer,
-	IN ULONG ReportBufferLen,
-	OUT size_t* BytesWritten
-);
-
 NTSTATUS
 RaydReadReport(
 	IN PRAYD_CONTEXT DevContext,
@@ -75,6 +75,18 @@ struct raydium_data_info {
 	UINT8 tp_info_size;
 };
 
+/* One contact record in the data bank, laid out at the RM_CONTACT_* offsets */
+#pragma pack(push, 1)
+struct raydium_contact {
+	UINT8 state;
+	UINT8 x[2];		/* little endian */
+	UINT8 y[2];		/* little endian */
+	UINT8 pressure;
+	UINT8 width_x;
+	UINT8 width_y;
+};
+#pragma pack(pop)
+
 struct raydium_info {
 	UINT32 hw_ver;		/*device version */
 	UINT8 main_ver;
@@ -29,6 +29,8 @@ static ULONG RaydDebugCatagories = DBG_INIT || DBG_PNP || DBG_IOCTL;
 NTSTATUS
 SpbDoWriteDataSynchronously(
 IN SPB_CONTEXT *SpbContext,
+IN PVOID Prefix,
+IN ULONG PrefixLength,
 IN PVOID Data,
 IN ULONG Length
 )
@@ -37,14 +39,17 @@ IN ULONG Length
 Routine Description:
 
 This helper routine abstracts creating and sending an I/O
-request (I2C Write) to the Spb I/O target.
+request (I2C Write) to the Spb I/O target. The prefix and data
+are assembled in the preallocated write buffer, so no memory is
+allocated per transfer.
 
 Arguments:
 
-SpbContext - Pointer to the current device context
-Address    - The I2C register address to write to
-Data       - A buffer to receive the data at at the above address
-Length     - The amount of data to be read from the above address
+SpbContext   - Pointer to the current device context
+Prefix       - Optional bytes sent ahead of the data (may be NULL)
+PrefixLength - Length of the prefix
+Data         - A buffer holding the data to write
+Length       - The amount of data to write
 
 Return Value:
 
@@ -54,49 +59,41 @@ NTSTATUS Status indicating success or failure
 {
 	PUCHAR buffer;
 	ULONG length;
-	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
 	NTSTATUS status;
 
-	length = Length;
-	memory = NULL;
-
-	if (length > DEFAULT_SPB_BUFFER_SIZE)
+	if (Prefix == NULL)
 	{
-		status = WdfMemoryCreate(
-			WDF_NO_OBJECT_ATTRIBUTES,
-			NonPagedPool,
-			RAYD_POOL_TAG,
-			length,
-			&memory,
-			(PVOID *)&buffer);
+		PrefixLength = 0;
+	}
 
-		if (!NT_SUCCESS(status))
-		{
-			RaydPrint(
-				DEBUG_LEVEL_ERROR,
-				DBG_IOCTL,
-				"Error allocating memory for Spb write - 0x%x\n",
-				status);
-			goto exit;
-		}
+	length = PrefixLength + Length;
 
-		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-			&memoryDescriptor,
-			memory,
-			NULL);
-	}
-	else
+	if (length > SpbContext->BufferSize)
 	{
-		buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+		status = STATUS_INVALID_BUFFER_SIZE;
 
-		WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-			&memoryDescriptor,
-			(PVOID)buffer,
-			length);
+		RaydPrint(
+			DEBUG_LEVEL_ERROR,
+			DBG_IOCTL,
+			"Spb write of %d bytes exceeds transport buffer - 0x%x\n",
+			length,
+			status);
+		goto exit;
 	}
 
-	RtlCopyMemory(buffer, Data, length);
+	buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->WriteMemory, NULL);
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)buffer,
+		length);
+
+	if (PrefixLength != 0)
+	{
+		RtlCopyMemory(buffer, Prefix, PrefixLength);
+	}
+	RtlCopyMemory(buffer + PrefixLength, Data, Length);
 
 	status = WdfIoTargetSendWriteSynchronously(
 		SpbContext->SpbIoTarget,
@@ -118,11 +115,6 @@ NTSTATUS Status indicating success or failure
 
 exit:
 
-	if (NULL != memory)
-	{
-		WdfObjectDelete(memory);
-	}
-
 	return status;
 }
 
@@ -157,12 +149,49 @@ NTSTATUS Status indicating success or failure
 
 	status = SpbDoWriteDataSynchronously(
 		SpbContext,
+		NULL,
+		0,
 		Data,
 		Length);
 
 	return status;
 }
 
+NTSTATUS
+SpbWriteRegisterSynchronously(
+IN SPB_CONTEXT *SpbContext,
+IN UCHAR Register,
+IN PVOID Data,
+IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+This routine writes a register address followed by its data as
+one I2C write, built directly in the preallocated write buffer.
+
+Arguments:
+
+SpbContext - Pointer to the current device context
+Register   - The register address to write to
+Data       - A buffer holding the data for the above register
+Length     - The amount of data to write
+
+Return Value:
+
+NTSTATUS Status indicating success or failure
+
+--*/
+{
+	return SpbDoWriteDataSynchronously(
+		SpbContext,
+		&Register,
+		sizeof(Register),
+		Data,
+		Length);
+}
+
 NTSTATUS
 SpbXferDataSynchronously(
 	_In_ SPB_CONTEXT* SpbContext,
@@ -185,12 +214,10 @@ NTSTATUS Status indicating success or failure
 --*/
 {
 	PUCHAR buffer;
-	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
 	NTSTATUS status;
 	ULONG_PTR bytesRead;
 
-	memory = NULL;
 	status = STATUS_INVALID_PARAMETER;
 	bytesRead = 0;
 
@@ -199,6 +226,8 @@ NTSTATUS Status indicating success or failure
 	//
 	status = SpbDoWriteDataSynchronously(
 		SpbContext,
+		NULL,
+		0,
 		SendData,
 		SendLength);
 
@@ -212,41 +241,25 @@ NTSTATUS Status indicating success or failure
 		goto exit;
 	}
 
-	if (Length > DEFAULT_SPB_BUFFER_SIZE)
+	if (Length > SpbContext->BufferSize)
 	{
-		status = WdfMemoryCreate(
-			WDF_NO_OBJECT_ATTRIBUTES,
-			NonPagedPool,
-			RAYD_POOL_TAG,
+		status = STATUS_INVALID_BUFFER_SIZE;
+
+		RaydPrint(
+			DEBUG_LEVEL_ERROR,
+			DBG_IOCTL,
+			"Spb read of %d bytes exceeds transport buffer - 0x%x\n",
 			Length,
-			&memory,
-			(PVOID*)&buffer);
-
-		if (!NT_SUCCESS(status))
-		{
-			RaydPrint(
-				DEBUG_LEVEL_ERROR,
-				DBG_IOCTL,
-				"Error allocating memory for Spb read - 0x%x\n",
-				status);
-			goto exit;
-		}
-
-		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-			&memoryDescriptor,
-			memory,
-			NULL);
-	}
-	else
-	{
-		buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
-
-		WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-			&memoryDescriptor,
-			(PVOID)buffer,
-			Length);
+			status);
+		goto exit;
 	}
 
+	buffer = (PUCHAR)WdfMemoryGetBuffer(SpbContext->ReadMemory, NULL);
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)buffer,
+		Length);
 
 	status = WdfIoTargetSendReadSynchronously(
 		SpbContext->SpbIoTarget,
@@ -256,8 +269,16 @@ NTSTATUS Status indicating success or failure
 		NULL,
 		&bytesRead);
 
-	if (!NT_SUCCESS(status) ||
+	if (NT_SUCCESS(status) &&
 		bytesRead != Length)
+	{
+		//
+		// A short read leaves stale bytes in the caller's buffer
+		//
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	if (!NT_SUCCESS(status))
 	{
 		RaydPrint(
 			DEBUG_LEVEL_ERROR,
@@ -273,11 +294,157 @@ NTSTATUS Status indicating success or failure
 	RtlCopyMemory(Data, buffer, Length);
 
 exit:
-	if (NULL != memory)
+	return status;
+}
+
+NTSTATUS
+SpbXferSequenceSynchronously(
+	_In_ SPB_CONTEXT* SpbContext,
+	_In_opt_ PVOID PrefixData,
+	_In_ ULONG PrefixLength,
+	_In_ PVOID SendData,
+	_In_ ULONG SendLength,
+	_In_reads_bytes_(Length) PVOID Data,
+	_In_ ULONG Length
+)
+/*++
+Routine Description:
+This helper routine sends an optional prefix write, the address write
+and the data read to the Spb I/O target as a single
+IOCTL_SPB_EXECUTE_SEQUENCE, so the controller issues repeated starts
+instead of separate transactions. SpbCx rejects sequences from a client
+holding the controller lock, so the caller must not hold it. Controllers
+that do not implement sequences are remembered and served by separate
+write and read requests under the controller lock.
+Arguments:
+SpbContext   - Pointer to the current device context
+PrefixData   - Optional buffer written before the address (may be NULL)
+PrefixLength - Length of the prefix buffer
+SendData     - The address pointer to write
+SendLength   - Length of the address pointer
+Data         - A buffer to receive the data at at the above address
+Length       - The amount of data to be read from the above address
+Return Value:
+NTSTATUS Status indicating success or failure
+--*/
+{
+	SPB_TRANSFER_LIST_AND_ENTRIES(3) sequence;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	NTSTATUS status;
+	ULONG_PTR bytesTransferred;
+	ULONG index;
+
+	if (PrefixData == NULL)
 	{
-		WdfObjectDelete(memory);
+		PrefixLength = 0;
+	}
+
+	if (SpbContext->SequenceUnsupported)
+	{
+		goto fallback;
+	}
+
+	index = 0;
+	bytesTransferred = 0;
+
+	if (PrefixLength != 0)
+	{
+		sequence.List.Transfers[index++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+			SpbTransferDirectionToDevice,
+			0,
+			PrefixData,
+			PrefixLength);
+	}
+
+	sequence.List.Transfers[index++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionToDevice,
+		0,
+		SendData,
+		SendLength);
+
+	sequence.List.Transfers[index++] = SPB_TRANSFER_LIST_ENTRY_INIT_SIMPLE(
+		SpbTransferDirectionFromDevice,
+		0,
+		Data,
+		Length);
+
+	SPB_TRANSFER_LIST_INIT(&(sequence.List), index);
+
+	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
+		&memoryDescriptor,
+		(PVOID)&sequence,
+		sizeof(sequence));
+
+	status = WdfIoTargetSendIoctlSynchronously(
+		SpbContext->SpbIoTarget,
+		NULL,
+		IOCTL_SPB_EXECUTE_SEQUENCE,
+		&memoryDescriptor,
+		NULL,
+		NULL,
+		&bytesTransferred);
+
+	if (status == STATUS_NOT_SUPPORTED ||
+		status == STATUS_NOT_IMPLEMENTED)
+	{
+		RaydPrint(
+			DEBUG_LEVEL_INFO,
+			DBG_IOCTL,
+			"Spb controller rejected sequence, using separate transfers - 0x%x\n",
+			status);
+		SpbContext->SequenceUnsupported = TRUE;
+		goto fallback;
+	}
+
+	if (NT_SUCCESS(status) &&
+		bytesTransferred != PrefixLength + SendLength + Length)
+	{
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		RaydPrint(
+			DEBUG_LEVEL_ERROR,
+			DBG_IOCTL,
+			"Error executing Spb sequence - 0x%x\n",
+			status);
 	}
 
+	return status;
+
+fallback:
+	//
+	// Keep other clients off the bus between the separate transfers
+	//
+	status = SpbLockController(SpbContext);
+	if (!NT_SUCCESS(status))
+	{
+		return status;
+	}
+
+	if (PrefixLength != 0)
+	{
+		status = SpbDoWriteDataSynchronously(
+			SpbContext,
+			NULL,
+			0,
+			PrefixData,
+			PrefixLength);
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		status = SpbXferDataSynchronously(
+			SpbContext,
+			SendData,
+			SendLength,
+			Data,
+			Length);
+	}
+
+	SpbUnlockController(SpbContext);
+
 	return status;
 }
 
@@ -377,6 +544,109 @@ SpbUnlockController(
 	return status;
 }
 
+NTSTATUS
+SpbTargetReserveBuffers(
+IN SPB_CONTEXT *SpbContext,
+IN ULONG Length
+)
+/*++
+
+Routine Description:
+
+This helper routine grows the preallocated transport buffers so that
+transfers of up to Length bytes never need to allocate. It is called
+once the firmware has reported its packet geometry; later transfers
+only ever use these buffers.
+
+Arguments:
+
+SpbContext - Pointer to the current device context
+Length     - Largest single write or read the caller will issue
+
+Return Value:
+
+NTSTATUS Status indicating success or failure
+
+--*/
+{
+	WDFMEMORY writeMemory = NULL;
+	WDFMEMORY readMemory = NULL;
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (Length <= SpbContext->BufferSize)
+	{
+		return status;
+	}
+
+	status = WdfMemoryCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		NonPagedPool,
+		RAYD_POOL_TAG,
+		Length,
+		&writeMemory,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		RaydPrint(
+			DEBUG_LEVEL_ERROR,
+			DBG_IOCTL,
+			"Error allocating memory for Spb write - %!STATUS!",
+			status);
+		goto exit;
+	}
+
+	status = WdfMemoryCreate(
+		WDF_NO_OBJECT_ATTRIBUTES,
+		NonPagedPool,
+		RAYD_POOL_TAG,
+		Length,
+		&readMemory,
+		NULL);
+
+	if (!NT_SUCCESS(status))
+	{
+		RaydPrint(
+			DEBUG_LEVEL_ERROR,
+			DBG_IOCTL,
+			"Error allocating memory for Spb read - %!STATUS!",
+			status);
+		goto exit;
+	}
+
+	//
+	// Swap the buffers in under the waitlock so no transfer is using them
+	//
+	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+	WdfObjectDelete(SpbContext->WriteMemory);
+	WdfObjectDelete(SpbContext->ReadMemory);
+
+	SpbContext->WriteMemory = writeMemory;
+	SpbContext->ReadMemory = readMemory;
+	SpbContext->BufferSize = Length;
+	SpbContext->BufferAllocations += 2;
+
+	WdfWaitLockRelease(SpbContext->SpbLock);
+
+	writeMemory = NULL;
+	readMemory = NULL;
+
+exit:
+
+	if (writeMemory != NULL)
+	{
+		WdfObjectDelete(writeMemory);
+	}
+
+	if (readMemory != NULL)
+	{
+		WdfObjectDelete(readMemory);
+	}
+
+	return status;
+}
+
 VOID
 SpbTargetDeinitialize(
 IN WDFDEVICE FxDevice,
@@ -554,6 +824,9 @@ NTSTATUS Status indicating success or failure
 		goto exit;
 	}
 
+	SpbContext->BufferSize = DEFAULT_SPB_BUFFER_SIZE;
+	SpbContext->BufferAllocations += 2;
+
 	//
 	// Allocate a waitlock to guard access to the default buffers
 	//
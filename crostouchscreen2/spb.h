@@ -37,6 +37,17 @@ typedef struct _SPB_CONTEXT
 	WDFMEMORY WriteMemory;
 	WDFMEMORY ReadMemory;
 	WDFWAITLOCK SpbLock;
+	ULONG BufferSize;
+	ULONG BufferAllocations;
+	BOOLEAN SequenceUnsupported;
+
+	//
+	// Last RM_CMD_BANK_SWITCH target, valid until a reset or bus error
+	//
+	UINT32 CurrentBank;
+	BOOLEAN BankValid;
+	ULONG BankSwitchesIssued;
+	ULONG BankSwitchesElided;
 } SPB_CONTEXT;
 
 NTSTATUS
@@ -48,6 +59,17 @@ SpbXferDataSynchronously(
 	_In_ ULONG Length
 );
 
+NTSTATUS
+SpbXferSequenceSynchronously(
+	_In_ SPB_CONTEXT* SpbContext,
+	_In_opt_ PVOID PrefixData,
+	_In_ ULONG PrefixLength,
+	_In_ PVOID SendData,
+	_In_ ULONG SendLength,
+	_In_reads_bytes_(Length) PVOID Data,
+	_In_ ULONG Length
+);
+
 VOID
 SpbTargetDeinitialize(
 IN WDFDEVICE FxDevice,
@@ -60,6 +82,12 @@ IN WDFDEVICE FxDevice,
 IN SPB_CONTEXT *SpbContext
 );
 
+NTSTATUS
+SpbTargetReserveBuffers(
+IN SPB_CONTEXT *SpbContext,
+IN ULONG Length
+);
+
 NTSTATUS
 SpbWriteDataSynchronously(
 IN SPB_CONTEXT *SpbContext,
@@ -67,6 +95,14 @@ IN PVOID Data,
 IN ULONG Length
 );
 
+NTSTATUS
+SpbWriteRegisterSynchronously(
+IN SPB_CONTEXT *SpbContext,
+IN UCHAR Register,
+IN PVOID Data,
+IN ULONG Length
+);
+
 NTSTATUS
 SpbLockController(
 	IN SPB_CONTEXT* SpbContext